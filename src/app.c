@@ -18,43 +18,85 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <signal.h>
 
 #include "app.h"
+#include "stats.h"
 #include "timer.h"
+#include "trace.h"
 #include "print.h"
 
 #define MM_TICKTIME 8
 
-typedef void (*MMAppEventHandler) (MMApp *, MMProgram *);
+/* Ranges continuous controls are mapped onto.  */
+#define MM_MIN_BPM 40.
+#define MM_MAX_BPM 240.
+#define MM_MAX_TRANSPOSE 12
+
+/* A nudge moves the tempo by up to this many bpm, once out of the dead
+   band around rest.  */
+#define MM_NUDGE_RANGE 40.
+#define MM_NUDGE_DEADBAND 0.1
+
+typedef void (*MMAppEventHandler) (MMApp *, MMProgram *,
+                                   const MMInputEvent *);
 
 struct _MMApp
 {
   bool quit;
+  bool report;
+  bool autostep;
+  bool recognize;
+  int preload;  /* ms, -1 for no preloading.  */
+  int cue;      /* Program change waiting to be preloaded, or -1.  */
+  MMRoute cue_route;
   MMInput *input;
   MMPlayer *player;
   MMTimer *timer;
   MMBeat beat;
   MMBeat *trigger;
+  double nudge_base;  /* bpm when the nudge left rest, or <= 0 at rest.  */
+  double nudge_peak;  /* Furthest the nudge has gone out.  */
   MMAppEventHandler event_handlers[MMIE_NUM_TYPES];
+  MMStats *latency[MMIE_NUM_TYPES];
+  MMStats *lateness;
 };
 
+/* SIGUSR1 asks for a report on the next tick.  */
+static volatile sig_atomic_t _report_pending = 0;
+
 static void on_tick (MMApp *, MMProgram *);
-static void on_quit (MMApp *, MMProgram *);
-static void on_killall (MMApp *, MMProgram *);
-static void on_next_step (MMApp *, MMProgram *);
-static void on_prev_seq (MMApp *, MMProgram *);
-static void on_next_seq (MMApp *, MMProgram *);
-static void on_tap (MMApp *, MMProgram *);
+static void on_quit (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_killall (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_next_step (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_prev_seq (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_next_seq (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_tap (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_tempo (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_expression (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_transpose (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_nudge (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_chord (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_clock (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_start (MMApp *, MMProgram *, const MMInputEvent *);
+static void on_stop (MMApp *, MMProgram *, const MMInputEvent *);
 
 static int get_event (MMApp *, MMInputEvent *);
+static void set_chord_tempo (MMApp *, MMSequence *, MMChord *);
 static void start_sequence (MMApp *, MMSequence *);
+static void cue_sequence (MMApp *, MMProgram *, MMSequence *);
+static void send_cue (MMApp *);
+static bool same_route (const MMRoute *, const MMRoute *);
+static void print_report (MMApp *, bool);
+static void on_report_signal (int);
 
 MMApp *
 mm_app_new (MMInput *input, MMPlayer *player)
 {
   MMApp *app;
+  struct sigaction sa;
 
-  assert (input != NULL);
+  /* Without input, only autostep moves the program forward.  */
   assert (player != NULL);
 
   app = calloc (1, sizeof (MMApp));
@@ -65,6 +107,10 @@ mm_app_new (MMInput *input, MMPlayer *player)
   app->player = player;
   app->timer = mm_timer_new ();
   app->trigger = NULL;
+  app->nudge_base = 0.;
+  app->nudge_peak = 0.;
+  app->preload = -1;
+  app->cue = -1;
 
   app->event_handlers[MMIE_QUIT] = on_quit;
   app->event_handlers[MMIE_KILLALL] = on_killall;
@@ -72,6 +118,22 @@ mm_app_new (MMInput *input, MMPlayer *player)
   app->event_handlers[MMIE_PREV_SEQ] = on_prev_seq;
   app->event_handlers[MMIE_NEXT_SEQ] = on_next_seq;
   app->event_handlers[MMIE_TAP] = on_tap;
+  app->event_handlers[MMIE_TEMPO] = on_tempo;
+  app->event_handlers[MMIE_EXPRESSION] = on_expression;
+  app->event_handlers[MMIE_TRANSPOSE] = on_transpose;
+  app->event_handlers[MMIE_NUDGE] = on_nudge;
+  app->event_handlers[MMIE_CHORD] = on_chord;
+  app->event_handlers[MMIE_CLOCK] = on_clock;
+  app->event_handlers[MMIE_START] = on_start;
+  app->event_handlers[MMIE_STOP] = on_stop;
+
+  for (int i = 0; i < MMIE_NUM_TYPES; ++i)
+    app->latency[i] = mm_stats_new (mm_input_event_name (i));
+  app->lateness = mm_stats_new ("wake_lateness");
+
+  sigaction (SIGUSR1, NULL, &sa);
+  sa.sa_handler = on_report_signal;
+  sigaction (SIGUSR1, &sa, NULL);
 
   return app;
 }
@@ -84,6 +146,9 @@ mm_app_free (MMApp *app)
       mm_input_free (app->input);
       mm_player_free (app->player);
       mm_timer_free (app->timer);
+      for (int i = 0; i < MMIE_NUM_TYPES; ++i)
+        mm_stats_free (app->latency[i]);
+      mm_stats_free (app->lateness);
       free (app);
     }
 }
@@ -100,7 +165,7 @@ mm_app_run (MMApp *app, MMProgram *program)
 
   timer = mm_timer_new ();
 
-  on_next_seq (app, program);
+  on_next_seq (app, program, NULL);
 
   while (!app->quit)
     {
@@ -109,12 +174,68 @@ mm_app_run (MMApp *app, MMProgram *program)
 
       on_tick (app, program);
 
+      if (_report_pending)
+        {
+          _report_pending = 0;
+          print_report (app, false);
+        }
+
       ticktime = mm_timer_get_age (timer);
       if (ticktime < MM_TICKTIME)
-        mm_sleep (MM_TICKTIME - ticktime);
+        {
+          uint64_t due = mm_time_us () + (MM_TICKTIME - ticktime) * 1000;
+          uint64_t now;
+          mm_sleep (MM_TICKTIME - ticktime);
+          now = mm_time_us ();
+          mm_stats_record (app->lateness, now > due ? now - due : 0);
+        }
     }
 
   mm_timer_free (timer);
+  /* Ramps belong to the program, which goes once this returns.  */
+  mm_player_set_ramp (app->player, NULL);
+
+  if (app->report)
+    print_report (app, true);
+}
+
+void
+mm_app_set_report (MMApp *app, bool report)
+{
+  if (app != NULL)
+    app->report = report;
+}
+
+/* Lets chords played on the input select sequence steps.  */
+void
+mm_app_set_recognize (MMApp *app, bool recognize)
+{
+  if (app != NULL)
+    {
+      app->recognize = recognize;
+      if (recognize)
+        mm_chord_build_names ();
+    }
+}
+
+/* Sends the program change of the next sequence PRELOAD ms before it
+   starts, or as soon as the last step of a sequence is played when that
+   is not known, giving the synth time to load the patch.  Negative turns
+   preloading off.  */
+void
+mm_app_set_preload (MMApp *app, int preload)
+{
+  if (app != NULL)
+    app->preload = preload < 0 ? -1 : preload;
+}
+
+/* Steps through every chord on its own, holding chords without a duration
+   for one beat.  */
+void
+mm_app_set_autostep (MMApp *app, bool autostep)
+{
+  if (app != NULL)
+    app->autostep = autostep;
 }
 
 static inline void
@@ -123,40 +244,65 @@ on_tick (MMApp *app, MMProgram *program)
   MMInputEvent event;
 
   mm_player_sync_clock (app->player);
+  send_cue (app);
 
   while (get_event (app, &event) > 0)
     {
       if (event.type < MMIE_NUM_TYPES
           && app->event_handlers[event.type] != NULL)
-        app->event_handlers[event.type] (app, program);
+        {
+          uint64_t now;
+          MM_TRACE_BEGIN (start);
+          app->event_handlers[event.type] (app, program, &event);
+          MM_TRACE_END (MMTP_DISPATCH, start, event.type);
+          /* Output is written synchronously by the handlers.  */
+          now = mm_time_us ();
+          mm_stats_record (app->latency[event.type],
+                           now > event.time ? now - event.time : 0);
+        }
       else
         MMERR ("Unhandled input event " MMCY ("%d"), event.type);
     }
 }
 
 static void
-on_quit (MMApp *app, MMProgram *prg)
+on_quit (MMApp *app, MMProgram *prg, const MMInputEvent *event)
 {
   app->quit = true;
-  on_killall (app, prg);
+  on_killall (app, prg, event);
 }
 
 static void
-on_killall (MMApp *app, MMProgram *prg)
+on_killall (MMApp *app, MMProgram *prg, const MMInputEvent *event)
 {
   (void) prg;
+  (void) event;
   mm_player_killall (app->player);
+  mm_player_stop (app->player);
 }
 
 static void
-on_next_step (MMApp *app, MMProgram *prg)
+on_next_step (MMApp *app, MMProgram *prg, const MMInputEvent *event)
 {
   MMSequence *seq = mm_program_current (prg);
+  bool first = mm_sequence_is_reset (seq);
   MMChord *chord = mm_sequence_next (seq);
 
   if (chord != NULL)
     {
+      /* Clock slaves start with the sequence and pick up at the step
+         played after a stop.  */
+      if (first)
+        mm_player_start (app->player);
+      else if (!mm_player_get_running (app->player))
+        {
+          int position = mm_sequence_get_position (seq);
+          mm_player_locate (app->player, mm_sequence_get_beat (seq, position));
+        }
+
       double duration = mm_chord_get_duration (chord);
+      if (duration <= 0. && app->autostep)
+        duration = 1.;
       if (duration > 0.)
         {
           app->trigger = &app->beat;
@@ -166,20 +312,24 @@ on_next_step (MMApp *app, MMProgram *prg)
       else
         app->trigger = NULL;
 
+      set_chord_tempo (app, seq, chord);
       if (mm_sequence_get_tap (seq))
-        on_tap (app, prg);
+        on_tap (app, prg, event);
 
       mm_player_play (app->player, chord);
+      cue_sequence (app, prg, seq);
     }
   else
-    on_next_seq (app, prg);
+    on_next_seq (app, prg, event);
 }
 
 static void
-on_prev_seq (MMApp *app, MMProgram *prg)
+on_prev_seq (MMApp *app, MMProgram *prg, const MMInputEvent *event)
 {
   MMSequence *seq = mm_program_current (prg);
 
+  (void) event;
+
   if (seq != NULL && mm_sequence_is_reset (seq))
     seq = mm_program_previous (prg);
 
@@ -191,24 +341,197 @@ on_prev_seq (MMApp *app, MMProgram *prg)
 }
 
 static void
-on_next_seq (MMApp *app, MMProgram *prg)
+on_next_seq (MMApp *app, MMProgram *prg, const MMInputEvent *event)
 {
   MMSequence *seq = mm_program_next (prg);
   if (seq != NULL)
     start_sequence (app, seq);
   else
-    on_quit (app, prg);
+    on_quit (app, prg, event);
 }
 
 static void
-on_tap (MMApp *app, MMProgram *prg)
+on_tap (MMApp *app, MMProgram *prg, const MMInputEvent *event)
 {
-  double bpm;
+  double bpm, ago;
   (void) prg;
+  (void) event;
   mm_timer_tap (app->timer);
   bpm = mm_timer_get_bpm (app->timer);
   if (bpm > 0.)
-    mm_player_set_bpm (app->player, bpm);
+    {
+      mm_player_set_bpm (app->player, bpm);
+      if (mm_timer_get_tap_beat (app->timer, &ago))
+        mm_player_align_beat (app->player, ago);
+    }
+}
+
+static void
+on_tempo (MMApp *app, MMProgram *prg, const MMInputEvent *event)
+{
+  (void) prg;
+  mm_player_set_bpm (app->player,
+                     MM_MIN_BPM + event->value * (MM_MAX_BPM - MM_MIN_BPM));
+  mm_timer_reset_tap (app->timer);
+}
+
+static void
+on_expression (MMApp *app, MMProgram *prg, const MMInputEvent *event)
+{
+  int velocity = 1 + (int) round (event->value * 126.);
+  MMSequence *seq = mm_program_current (prg);
+  MMChord *chord = mm_sequence_get_chord (seq,
+                                          mm_sequence_get_position (seq));
+  const MMRoute *route = mm_sequence_get_route (seq);
+  const MMRoute *bass;
+
+  mm_player_set_velocity (app->player, velocity);
+
+  /* Expression goes where the notes playing went.  */
+  if (chord != NULL)
+    route = mm_chord_get_route (chord);
+  mm_player_send_to (app->player, route, 0xB0, 0x0B, velocity, 0);
+
+  bass = mm_chord_get_bass_route (chord);
+  if (bass->channel >= 0
+      && (bass->channel != route->channel || bass->port != route->port))
+    mm_player_send_to (app->player, bass, 0xB0, 0x0B, velocity, 0);
+}
+
+static void
+on_transpose (MMApp *app, MMProgram *prg, const MMInputEvent *event)
+{
+  (void) prg;
+  mm_player_set_transpose (app->player,
+                           (int) round ((event->value * 2. - 1.)
+                                        * MM_MAX_TRANSPOSE));
+}
+
+/* Self-centering controls would snap the tempo back when let go, so the
+   tempo follows a nudge only as it goes further out from rest and stays
+   where it got to.  */
+static void
+on_nudge (MMApp *app, MMProgram *prg, const MMInputEvent *event)
+{
+  double offset = event->value * 2. - 1.;
+  double bpm;
+
+  (void) prg;
+
+  if (fabs (offset) < MM_NUDGE_DEADBAND)
+    {
+      app->nudge_base = 0.;
+      return;
+    }
+
+  if (app->nudge_base <= 0. || offset * app->nudge_peak < 0.)
+    {
+      app->nudge_base = mm_player_get_bpm (app->player);
+      app->nudge_peak = 0.;
+    }
+
+  if (fabs (offset) <= fabs (app->nudge_peak))
+    return;
+
+  app->nudge_peak = offset;
+  bpm = app->nudge_base + copysign (MM_NUDGE_RANGE, offset)
+    * (fabs (offset) - MM_NUDGE_DEADBAND) / (1. - MM_NUDGE_DEADBAND);
+  mm_player_set_bpm (app->player, fmin (fmax (bpm, MM_MIN_BPM), MM_MAX_BPM));
+  mm_timer_reset_tap (app->timer);
+}
+
+/* Selects the step of the current sequence closest to the chord held,
+   searching from the next step on so repeated chords keep advancing.  */
+static void
+on_chord (MMApp *app, MMProgram *prg, const MMInputEvent *event)
+{
+  MMSequence *seq = mm_program_current (prg);
+  MMChord *chord;
+  unsigned int held = (unsigned int) event->value;
+  unsigned int mask = held & 0xFFF;
+  int nchords = mm_sequence_get_length (seq);
+  int position = mm_sequence_get_position (seq);
+  int best = -1, best_score = 0, nheld, nbest;
+  char name[32];
+
+  if (!app->recognize || mask == 0)
+    return;
+
+  mm_chord_name_mask (mask, held / MMIE_CHORD_BASS, name, sizeof (name));
+  mm_print_cmd ("HEARD", true);
+  MMUI (MMCY ("%s") "\n", name);
+  mm_print_cmd_end ();
+
+  for (int i = 1; i <= nchords; ++i)
+    {
+      int step = (position + i) % nchords;
+      unsigned int candidate;
+      int score;
+
+      candidate = mm_chord_get_mask (mm_sequence_get_chord (seq, step));
+      score = 2 * __builtin_popcount (mask & candidate)
+        - __builtin_popcount (candidate & ~mask)
+        - __builtin_popcount (mask & ~candidate);
+      if (score > best_score)
+        {
+          best = step;
+          best_score = score;
+        }
+    }
+
+  if (best < 0 || best == position)
+    return;
+
+  /* Wait for most of the chord, at least three notes of it.  */
+  nheld = __builtin_popcount (mask);
+  chord = mm_sequence_get_chord (seq, best);
+  nbest = __builtin_popcount (mm_chord_get_mask (chord));
+  if (best_score < nbest || nheld < (nbest < 3 ? nbest : 3))
+    return;
+
+  /* Clock slaves keep running when the step played is the next one and
+     are moved to it on a jump, the top starting them over.  */
+  mm_sequence_seek (seq, best - 1);
+  if (best > 0 && best != position + 1)
+    mm_player_locate (app->player, mm_sequence_get_beat (seq, best));
+  on_next_step (app, prg, event);
+}
+
+static void
+on_clock (MMApp *app, MMProgram *prg, const MMInputEvent *event)
+{
+  (void) prg;
+  mm_player_clock_pulse (app->player, event->time);
+}
+
+/* Start plays the current sequence from the top on the first pulse,
+   continue picks up where stop left off.  */
+static void
+on_start (MMApp *app, MMProgram *prg, const MMInputEvent *event)
+{
+  MMSequence *seq = mm_program_current (prg);
+
+  if (!mm_player_get_slave (app->player) || event->value <= 0.)
+    return;
+
+  mm_player_clock_start (app->player);
+  if (seq != NULL)
+    {
+      mm_sequence_reset (seq);
+      app->trigger = &app->beat;
+      app->beat.i = 0;
+      app->beat.f = 0.;
+    }
+}
+
+static void
+on_stop (MMApp *app, MMProgram *prg, const MMInputEvent *event)
+{
+  if (!mm_player_get_slave (app->player))
+    return;
+
+  app->trigger = NULL;
+  on_killall (app, prg, event);
 }
 
 static inline int
@@ -222,9 +545,11 @@ get_event (MMApp *app, MMInputEvent *event)
       int timeout = mm_player_get_time_to_beat (app->player, app->trigger);
       if (timeout < MM_TICKTIME)
         {
+          event->time = mm_time_us () + (timeout > 0 ? timeout * 1000 : 0);
           if (timeout > 0)
             mm_sleep (timeout);
           event->type = MMIE_NEXT_STEP;
+          event->value = 1.;
           app->trigger = NULL;
           return 1;
         }
@@ -233,6 +558,23 @@ get_event (MMApp *app, MMInputEvent *event)
   return mm_input_read (app->input, event);
 }
 
+static void
+set_chord_tempo (MMApp *app, MMSequence *seq, MMChord *chord)
+{
+  const MMTempoRamp *ramp;
+  double bpm = mm_chord_get_bpm (chord);
+
+  if (bpm <= 0.)
+    return;
+
+  ramp = mm_sequence_get_ramp (seq, mm_sequence_get_position (seq));
+  if (ramp != NULL)
+    mm_player_set_ramp (app->player, ramp);
+  else
+    mm_player_set_bpm (app->player, bpm);
+  mm_timer_reset_tap (app->timer);
+}
+
 static void
 start_sequence (MMApp *app, MMSequence *seq)
 {
@@ -240,10 +582,13 @@ start_sequence (MMApp *app, MMSequence *seq)
   char midiprgname[5] = "None";
   double bpm = mm_sequence_get_bpm (seq);
 
+  app->cue = -1;
+
   if (midiprg >= 0)
     {
       midiprg &= 0x7F;
-      mm_player_send (app->player, 0xC0, midiprg, 0, 0);
+      mm_player_send_to (app->player, mm_sequence_get_route (seq),
+                         0xC0, midiprg, 0, 0);
       snprintf (midiprgname, 5, "0x%.2X", midiprg);
     }
 
@@ -263,4 +608,99 @@ start_sequence (MMApp *app, MMSequence *seq)
     }
 
   app->trigger = NULL;
+  if (app->autostep)
+    {
+      app->trigger = &app->beat;
+      mm_player_get_beat (app->player, app->trigger);
+    }
+}
+
+/* Cues the program change of the sequence after SEQ once SEQ is on its
+   last step.  */
+static void
+cue_sequence (MMApp *app, MMProgram *prg, MMSequence *seq)
+{
+  MMSequence *next;
+  const MMRoute *route;
+  MMChord *chord;
+  int midiprg;
+
+  if (app->preload < 0 || mm_sequence_get_loop (seq) > 0
+      || mm_sequence_get_position (seq) < mm_sequence_get_length (seq) - 1)
+    return;
+
+  next = mm_program_peek (prg);
+  midiprg = mm_sequence_get_midiprg (next);
+  if (midiprg < 0)
+    return;
+
+  /* With no step time to count down to, the program change would go out
+     right away, switching the patch under the chord held on the same
+     channel.  That one is left to the sequence start.  */
+  route = mm_sequence_get_route (next);
+  if (app->trigger == NULL)
+    {
+      chord = mm_sequence_get_chord (seq, mm_sequence_get_position (seq));
+      if (same_route (route, mm_chord_get_route (chord))
+          || same_route (route, mm_chord_get_bass_route (chord)))
+        return;
+    }
+
+  app->cue = midiprg & 0x7F;
+  app->cue_route = *route;
+  send_cue (app);
+}
+
+static bool
+same_route (const MMRoute *a, const MMRoute *b)
+{
+  return a->port == b->port && a->channel == b->channel;
+}
+
+/* Sends the cued program change once the next sequence is due within the
+   preload time.  The device state cache then drops the one sent when the
+   sequence starts.  */
+static void
+send_cue (MMApp *app)
+{
+  if (app->cue < 0)
+    return;
+
+  if (app->trigger != NULL
+      && mm_player_get_time_to_beat (app->player, app->trigger) > app->preload)
+    return;
+
+  mm_player_send_to (app->player, &app->cue_route, 0xC0, app->cue, 0, 0);
+  app->cue = -1;
+}
+
+static void
+print_stats (MMStats *stats, bool reset)
+{
+  char line[128];
+
+  if (mm_stats_get_count (stats) > 0
+      && mm_stats_format (stats, line, sizeof (line)) > 0)
+    mm_printf ("%s\n", line);
+  if (reset)
+    mm_stats_reset (stats);
+}
+
+static void
+print_report (MMApp *app, bool reset)
+{
+  mm_printf ("\nInput to output latency (us)\n");
+  for (int i = 0; i < MMIE_NUM_TYPES; ++i)
+    print_stats (app->latency[i], reset);
+
+  mm_printf ("\nTiming (us)\n");
+  print_stats (mm_player_get_jitter (app->player), reset);
+  print_stats (app->lateness, reset);
+}
+
+static void
+on_report_signal (int sig)
+{
+  (void) sig;
+  _report_pending = 1;
 }
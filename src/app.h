@@ -18,6 +18,8 @@
 #ifndef MM_APP_H
 #define MM_APP_H 1
 
+#include <stdbool.h>
+
 #include "input.h"
 #include "player.h"
 #include "program.h"
@@ -27,5 +29,9 @@ typedef struct _MMApp MMApp;
 MMApp *mm_app_new (MMInput *, MMPlayer *);
 void mm_app_free (MMApp *);
 void mm_app_run (MMApp *, MMProgram *);
+void mm_app_set_report (MMApp *, bool);
+void mm_app_set_autostep (MMApp *, bool);
+void mm_app_set_recognize (MMApp *, bool);
+void mm_app_set_preload (MMApp *, int);
 
 #endif /* ! MM_APP_H */
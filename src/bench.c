@@ -0,0 +1,238 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Microbenchmarks for the hot paths, run with `make bench`.  Every result
+   is printed as one line of key=value pairs.  Give benchmark names as
+   arguments to run only those.  */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chord.h"
+#include "console.h"
+#include "output.h"
+#include "output_null.h"
+#include "player.h"
+#include "program.h"
+#include "program_factory.h"
+#include "timer.h"
+
+/* Each benchmark repeats until it has run for at least MIN_TIME ns.  */
+#define MIN_TIME 200000000ULL
+
+/* The largest setlist a program holds.  */
+#define NUM_SEQUENCES 64
+#define NUM_CHORDS 64
+
+typedef void (*MMBenchFunc) (void *, unsigned long);
+
+typedef struct
+{
+  const char *name;
+  MMBenchFunc func;
+} MMBench;
+
+static const char *_chord_names[] = {
+  "C", "Am7", "G7/B", "Dm9", "G13", "Fmaj7", "Em7b5", "A7b9",
+  "Bbmaj9#11", "Ebm6", "Abdim7", "Db7sus4", "F#m11", "Baug", "Esus2",
+  "Cadd9"
+};
+
+#define NUM_CHORD_NAMES (sizeof (_chord_names) / sizeof (_chord_names[0]))
+
+static char _program_path[] = "/tmp/MemfisMIDI-bench-XXXXXX";
+
+static uint64_t
+now_ns ()
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return ((uint64_t) now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+static void
+bench_chord_new (void *data, unsigned long n)
+{
+  (void) data;
+  for (unsigned long i = 0; i < n; ++i)
+    mm_chord_free (mm_chord_new (_chord_names[i % NUM_CHORD_NAMES]));
+}
+
+static void
+bench_chord_get_notes (void *data, unsigned long n)
+{
+  MMChord **chords = (MMChord **) data;
+  int notes[12];
+  for (unsigned long i = 0; i < n; ++i)
+    mm_chord_get_notes (chords[i % NUM_CHORD_NAMES], notes, 12);
+}
+
+static void
+bench_chord_build_names (void *data, unsigned long n)
+{
+  (void) data;
+  for (unsigned long i = 0; i < n; ++i)
+    mm_chord_build_names ();
+}
+
+/* Tables built by chord_build_names, or in main.  */
+static void
+bench_chord_name_mask (void *data, unsigned long n)
+{
+  char name[32];
+  (void) data;
+  for (unsigned long i = 0; i < n; ++i)
+    mm_chord_name_mask ((unsigned int) (i % 4095) + 1, (int) i, name, 32);
+}
+
+static void
+bench_player_play (void *data, unsigned long n)
+{
+  MMChord **chords = (MMChord **) data;
+  MMOutputDevice device = { mm_output_null_backend->name, 0, "" };
+  MMPlayer *player = mm_player_new (mm_output_new (&device));
+
+  for (unsigned long i = 0; i < n; ++i)
+    mm_player_play (player, chords[i % NUM_CHORD_NAMES]);
+
+  mm_player_free (player);
+}
+
+static void
+bench_program_factory (void *data, unsigned long n)
+{
+  (void) data;
+  for (unsigned long i = 0; i < n; ++i)
+    mm_program_free (mm_program_factory (_program_path, -1));
+}
+
+static void
+bench_timer_get_age (void *data, unsigned long n)
+{
+  MMTimer *timer = mm_timer_new ();
+  volatile unsigned int age;
+  (void) data;
+  for (unsigned long i = 0; i < n; ++i)
+    age = mm_timer_get_age (timer);
+  (void) age;
+  mm_timer_free (timer);
+}
+
+static const MMBench _benches[] = {
+  { "chord_new", bench_chord_new },
+  { "chord_get_notes", bench_chord_get_notes },
+  { "chord_build_names", bench_chord_build_names },
+  { "chord_name_mask", bench_chord_name_mask },
+  { "player_play", bench_player_play },
+  { "program_factory", bench_program_factory },
+  { "timer_get_age", bench_timer_get_age }
+};
+
+#define NUM_BENCHES (sizeof (_benches) / sizeof (_benches[0]))
+
+/* A setlist of NUM_SEQUENCES sequences with NUM_CHORDS chords each, every
+   fourth chord in the long form.  */
+static bool
+write_program ()
+{
+  FILE *file;
+  int fd = mkstemp (_program_path);
+
+  if (fd < 0 || (file = fdopen (fd, "w")) == NULL)
+    return false;
+
+  for (int s = 0; s < NUM_SEQUENCES; ++s)
+    {
+      fprintf (file, "---\nname: Sequence %d\nbpm: %d\nprogram: %d\n"
+               "loop: %d\ntap: %s\nchords:\n",
+               s, 60 + s % 120, s % 128, s % 3, s % 2 ? "yes" : "no");
+      for (int c = 0; c < NUM_CHORDS; ++c)
+        {
+          const char *name = _chord_names[(s + c) % NUM_CHORD_NAMES];
+          if (c % 4 == 3)
+            fprintf (file, "  - name: %s\n    duration: %d\n"
+                     "    delay: 0.25\n    break: 0.125\n    lift: %s\n",
+                     name, c % 8, c % 8 == 7 ? "yes" : "no");
+          else
+            fprintf (file, "  - %s\n", name);
+        }
+    }
+
+  return fclose (file) == 0;
+}
+
+static void
+run (const MMBench *bench, void *data)
+{
+  unsigned long n = 1;
+  uint64_t elapsed;
+
+  for (;;)
+    {
+      uint64_t start = now_ns ();
+      bench->func (data, n);
+      elapsed = now_ns () - start;
+      if (elapsed >= MIN_TIME)
+        break;
+      n *= (elapsed > 0 && elapsed < MIN_TIME / 100) ? 100 : 2;
+    }
+
+  printf ("bench=%s iterations=%lu ns_per_op=%.1f\n",
+          bench->name, n, (double) elapsed / n);
+  fflush (stdout);
+}
+
+int
+main (int argc, char **argv)
+{
+  MMChord *chords[NUM_CHORD_NAMES];
+
+  mm_console_set_headless (true);
+  mm_output_register_backend (mm_output_null_backend);
+  mm_chord_build_names ();
+
+  for (size_t i = 0; i < NUM_CHORD_NAMES; ++i)
+    {
+      chords[i] = mm_chord_new (_chord_names[i]);
+      assert (chords[i] != NULL);
+    }
+
+  if (!write_program ())
+    {
+      fprintf (stderr, "Failed to write %s\n", _program_path);
+      return EXIT_FAILURE;
+    }
+
+  for (size_t i = 0; i < NUM_BENCHES; ++i)
+    {
+      bool selected = (argc < 2);
+      for (int arg = 1; arg < argc && !selected; ++arg)
+        selected = (strcmp (argv[arg], _benches[i].name) == 0);
+      if (selected)
+        run (&_benches[i], chords);
+    }
+
+  unlink (_program_path);
+  for (size_t i = 0; i < NUM_CHORD_NAMES; ++i)
+    mm_chord_free (chords[i]);
+
+  return EXIT_SUCCESS;
+}
@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdio.h>
 
 #include "chord.h"
 
@@ -44,10 +45,41 @@ struct _MMChord
   double delay;
   double broken;
   double duration;
+  double bpm;
+  double ramp;
+  MMRoute route;
+  MMRoute bass;
 };
 
+static const MMRoute no_route = { -1, -1 };
+
 static int dom_scale[7] = {0, 2, 4, 5, 7, 9, 10};
 
+static const char *root_names[12] = {
+  "C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B"
+};
+
+/* Suffixes tried when naming notes, simplest first.  */
+static const char *name_suffixes[] = {
+  "", "m", "7", "maj7", "m7", "5", "sus4", "sus2", "dim", "aug", "6",
+  "m6", "dim7", "m7b5", "7sus4", "mMaj7", "add9", "madd9", "9", "maj9",
+  "m9", "6add9", "7b9", "7#9", "7b5", "7#5", "aug7", "7#11", "11", "m11",
+  "13", "maj13", "m13"
+};
+
+#define NUM_NAME_SUFFIXES (sizeof (name_suffixes) / sizeof (name_suffixes[0]))
+
+/* Pitch class sets of every suffix on every root, indexed by the 12 bit
+   mask of the set.  EXACT holds the suffix index + 1 per root naming the
+   set exactly, NEAREST the closest chord for sets without a name.  */
+static unsigned char exact_names[4096][12];
+static struct
+{
+  signed char root;
+  unsigned char suffix;
+} nearest_names[4096];
+static bool names_ready = false;
+
 static int parse_root (const char *, char **);
 static int parse_quality (const char *, char **);
 static int parse_extension (const char *, char **);
@@ -55,6 +87,7 @@ static void set_quality (MMChord *, const char *, char **);
 static void set_extension (MMChord *, const char *, char **);
 static void add_alteration (MMChord *, const char *, char **);
 static void set_bass (MMChord *, const char *, char **);
+static unsigned int get_mask (const int *, int);
 
 MMChord *
 mm_chord_new (const char *name)
@@ -79,6 +112,10 @@ mm_chord_new (const char *name)
   chord->lift = false;
   chord->delay = 0.;
   chord->broken = 0.;
+  chord->bpm = -1.;
+  chord->ramp = 0.;
+  chord->route = no_route;
+  chord->bass = no_route;
 
   suffix = endptr;
   set_quality (chord, suffix, &endptr);
@@ -244,6 +281,144 @@ mm_chord_set_duration (MMChord *chord, double duration)
     chord->duration = duration;
 }
 
+double
+mm_chord_get_bpm (const MMChord *chord)
+{
+  return (chord != NULL) ? chord->bpm : -1.;
+}
+
+void
+mm_chord_set_bpm (MMChord *chord, double bpm)
+{
+  if (chord != NULL)
+    chord->bpm = bpm;
+}
+
+/* Returns the number of beats the tempo takes to reach the chord bpm, 0
+   changes it at once.  */
+double
+mm_chord_get_ramp (const MMChord *chord)
+{
+  return (chord != NULL) ? chord->ramp : 0.;
+}
+
+void
+mm_chord_set_ramp (MMChord *chord, double ramp)
+{
+  if (chord != NULL && ramp >= 0.)
+    chord->ramp = ramp;
+}
+
+const MMRoute *
+mm_chord_get_route (const MMChord *chord)
+{
+  return (chord != NULL) ? &chord->route : &no_route;
+}
+
+void
+mm_chord_set_route (MMChord *chord, const MMRoute *route)
+{
+  if (chord != NULL && route != NULL)
+    chord->route = *route;
+}
+
+/* Returns the route of the lowest note of CHORD, split off as a bass
+   layer unless both fields are -1.  */
+const MMRoute *
+mm_chord_get_bass_route (const MMChord *chord)
+{
+  return (chord != NULL) ? &chord->bass : &no_route;
+}
+
+void
+mm_chord_set_bass_route (MMChord *chord, const MMRoute *route)
+{
+  if (chord != NULL && route != NULL)
+    chord->bass = *route;
+}
+
+/* Returns the pitch classes of CHORD as a 12 bit mask, C in bit 0.  */
+unsigned int
+mm_chord_get_mask (const MMChord *chord)
+{
+  unsigned int mask = 0;
+  int root;
+
+  if (chord == NULL)
+    return 0;
+
+  root = ((chord->root % 12) + 12) % 12;
+  for (int i = 0; i < 12; ++i)
+    if (chord->notes[i] != 0)
+      mask |= 1 << ((root + i) % 12);
+
+  return mask;
+}
+
+/* Names the pitch classes in MASK over the pitch class BASS in the
+   notation mm_chord_new parses, writing at most SIZE bytes to NAME.  Sets
+   without a name get the name of the closest chord.  Returns the length
+   of the name or -1 for an empty set.  */
+int
+mm_chord_name_mask (unsigned int mask, int bass, char *name, size_t size)
+{
+  int root = -1, suffix = 0;
+
+  mask &= 0xFFF;
+  if (mask == 0 || name == NULL)
+    return -1;
+
+  if (!names_ready)
+    mm_chord_build_names ();
+
+  bass = ((bass % 12) + 12) % 12;
+
+  /* Prefer the bass as root, then the simplest chord.  */
+  for (int i = 0; i < 12; ++i)
+    {
+      int r = (bass + i) % 12;
+      if (exact_names[mask][r] > 0
+          && (root < 0 || exact_names[mask][r] < suffix))
+        {
+          root = r;
+          suffix = exact_names[mask][r];
+          if (i == 0)
+            break;
+        }
+    }
+
+  if (root < 0)
+    {
+      root = nearest_names[mask].root;
+      suffix = nearest_names[mask].suffix + 1;
+    }
+
+  if (root == bass)
+    return snprintf (name, size, "%s%s", root_names[root],
+                     name_suffixes[suffix - 1]);
+
+  return snprintf (name, size, "%s%s/%s", root_names[root],
+                   name_suffixes[suffix - 1], root_names[bass]);
+}
+
+/* Like mm_chord_name_mask for the NNOTES MIDI notes in NOTES, the lowest
+   of them being the bass.  */
+int
+mm_chord_name_notes (const int *notes, int nnotes, char *name, size_t size)
+{
+  int bass;
+
+  if (notes == NULL || nnotes <= 0)
+    return -1;
+
+  bass = notes[0];
+  for (int i = 1; i < nnotes; ++i)
+    if (notes[i] < bass)
+      bass = notes[i];
+
+  return mm_chord_name_mask (get_mask (notes, nnotes), bass, name, size);
+}
+
 static int
 parse_root (const char *note, char **endptr)
 {
@@ -402,10 +577,13 @@ set_extension (MMChord *chord, const char *extension, char **endptr)
     {
     case 13:
       chord->notes[9] = 2;
+      /* fall through */
     case 11:
       chord->notes[5] = 2;
+      /* fall through */
     case 9:
       chord->notes[2] = 2;
+      /* fall through */
     case 7:
       if ((chord->quality & MM_DIM) && ext == 7)
         chord->notes[9] = 1;
@@ -518,3 +696,82 @@ set_bass (MMChord *chord, const char *bass, char **endptr)
 
   chord->notes[note % 12] = -1;
 }
+
+static unsigned int
+get_mask (const int *notes, int nnotes)
+{
+  unsigned int mask = 0;
+  for (int i = 0; i < nnotes; ++i)
+    mask |= 1 << (((notes[i] % 12) + 12) % 12);
+  return mask;
+}
+
+static inline unsigned int
+rotate_mask (unsigned int mask, int n)
+{
+  return ((mask << n) | (mask >> (12 - n))) & 0xFFF;
+}
+
+/* Builds the pitch class tables from the chords mm_chord_new makes out of
+   each suffix, so every name given out parses back to the same set.  This
+   takes milliseconds, so callers naming chords as they are played should
+   call it up front rather than leave it to the first name.  */
+void
+mm_chord_build_names ()
+{
+  unsigned int masks[NUM_NAME_SUFFIXES];
+
+  for (size_t s = 0; s < NUM_NAME_SUFFIXES; ++s)
+    {
+      char name[16];
+      int notes[24];
+      int nnotes;
+      MMChord *chord;
+
+      snprintf (name, sizeof (name), "C%s", name_suffixes[s]);
+      chord = mm_chord_new (name);
+      assert (chord != NULL);
+      nnotes = mm_chord_get_notes (chord, notes, 24);
+      masks[s] = get_mask (notes, nnotes);
+      mm_chord_free (chord);
+
+      for (int r = 0; r < 12; ++r)
+        {
+          unsigned char *exact = &exact_names[rotate_mask (masks[s], r)][r];
+          if (*exact == 0)
+            *exact = s + 1;
+        }
+    }
+
+  for (unsigned int mask = 1; mask < 4096; ++mask)
+    {
+      int best = -1;
+
+      nearest_names[mask].root = 0;
+      nearest_names[mask].suffix = 0;
+
+      for (size_t s = 0; s < NUM_NAME_SUFFIXES; ++s)
+        {
+          for (int r = 0; r < 12; ++r)
+            {
+              unsigned int candidate = rotate_mask (masks[s], r);
+              int score;
+
+              if ((mask & (1 << r)) == 0)
+                continue;
+
+              score = 2 * __builtin_popcount (mask & candidate)
+                - __builtin_popcount (candidate & ~mask)
+                - __builtin_popcount (mask & ~candidate);
+              if (score > best)
+                {
+                  best = score;
+                  nearest_names[mask].root = r;
+                  nearest_names[mask].suffix = s;
+                }
+            }
+        }
+    }
+
+  names_ready = true;
+}
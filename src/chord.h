@@ -19,9 +19,18 @@
 #define MM_CHORD_H 1
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct _MMChord MMChord;
 
+/* Where notes are played: a CHANNEL, 0-15, on a PORT, 0 being the main
+   output.  Fields at -1 are taken from the sequence.  */
+typedef struct
+{
+  int port;
+  int channel;
+} MMRoute;
+
 MMChord *mm_chord_new (const char *);
 void mm_chord_free (MMChord *);
 const char *mm_chord_get_name (const MMChord *);
@@ -36,5 +45,17 @@ double mm_chord_get_broken (const MMChord *);
 void mm_chord_set_broken (MMChord *, double);
 double mm_chord_get_duration (const MMChord *);
 void mm_chord_set_duration (MMChord *, double);
+double mm_chord_get_bpm (const MMChord *);
+void mm_chord_set_bpm (MMChord *, double);
+double mm_chord_get_ramp (const MMChord *);
+void mm_chord_set_ramp (MMChord *, double);
+const MMRoute *mm_chord_get_route (const MMChord *);
+void mm_chord_set_route (MMChord *, const MMRoute *);
+const MMRoute *mm_chord_get_bass_route (const MMChord *);
+void mm_chord_set_bass_route (MMChord *, const MMRoute *);
+unsigned int mm_chord_get_mask (const MMChord *);
+void mm_chord_build_names ();
+int mm_chord_name_mask (unsigned int, int, char *, size_t);
+int mm_chord_name_notes (const int *, int, char *, size_t);
 
 #endif /* ! MM_CHORD_H */
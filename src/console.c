@@ -0,0 +1,220 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/ioctl.h>
+
+#include "console.h"
+#include "ring.h"
+
+/* Once started, everything printed is only copied into a ring buffer and
+   a rendering thread writes it to the terminal, so a slow terminal never
+   holds up playback.  Errors get a ring of their own drained to stderr.
+   Only the main thread may use the rings, errors from other threads are
+   written directly.  When a ring is full output is dropped rather than
+   waited for.  */
+
+#define RING_SIZE (64 * 1024)
+#define LINE_SIZE 1024
+#define DEFAULT_WIDTH 80
+
+static MMRing *_ring = NULL;
+static MMRing *_error_ring = NULL;
+static sem_t _pending;
+static pthread_t _thread;
+static pthread_t _main_thread;
+static bool _quit = false;
+static bool _headless = false;
+static unsigned int _dropped = 0;
+
+static volatile sig_atomic_t _width = 0;
+
+static void
+update_width ()
+{
+  struct winsize size;
+  if (ioctl (STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+    _width = size.ws_col;
+  else
+    _width = DEFAULT_WIDTH;
+}
+
+static void
+mm_sigwinch_handler (int sig)
+{
+  (void) sig;
+  update_width ();
+}
+
+static void
+drain ()
+{
+  char buf[4096];
+  size_t nread;
+
+  while ((nread = mm_ring_read (_error_ring, buf, sizeof (buf))) > 0)
+    fwrite (buf, 1, nread, stderr);
+
+  while ((nread = mm_ring_read (_ring, buf, sizeof (buf))) > 0)
+    fwrite (buf, 1, nread, stdout);
+  fflush (stdout);
+}
+
+static void *
+mm_console_thread (void *data)
+{
+  (void) data;
+
+  while (!__atomic_load_n (&_quit, __ATOMIC_ACQUIRE))
+    {
+      sem_wait (&_pending);
+      drain ();
+    }
+
+  return NULL;
+}
+
+void
+mm_console_start ()
+{
+  struct sigaction sa;
+
+  if (_ring != NULL)
+    return;
+
+  sigaction (SIGWINCH, NULL, &sa);
+  sa.sa_handler = mm_sigwinch_handler;
+  sa.sa_flags |= SA_RESTART;
+  sigaction (SIGWINCH, &sa, NULL);
+  update_width ();
+
+  fflush (stdout);
+  _ring = mm_ring_new (RING_SIZE);
+  _error_ring = mm_ring_new (RING_SIZE);
+  _main_thread = pthread_self ();
+  sem_init (&_pending, 0, 0);
+  _quit = false;
+  if (pthread_create (&_thread, NULL, mm_console_thread, NULL) != 0)
+    {
+      sem_destroy (&_pending);
+      mm_ring_free (_ring);
+      mm_ring_free (_error_ring);
+      _ring = NULL;
+      _error_ring = NULL;
+    }
+}
+
+void
+mm_console_stop ()
+{
+  if (_ring == NULL)
+    return;
+
+  __atomic_store_n (&_quit, true, __ATOMIC_RELEASE);
+  sem_post (&_pending);
+  pthread_join (_thread, NULL);
+  drain ();
+
+  sem_destroy (&_pending);
+  mm_ring_free (_ring);
+  mm_ring_free (_error_ring);
+  _ring = NULL;
+  _error_ring = NULL;
+
+  if (_dropped > 0)
+    fprintf (stderr, "%u console writes dropped\n", _dropped);
+  _dropped = 0;
+}
+
+bool
+mm_console_get_headless ()
+{
+  return _headless;
+}
+
+void
+mm_console_set_headless (bool headless)
+{
+  _headless = headless;
+}
+
+static void
+enqueue (MMRing *ring, const char *format, va_list ap)
+{
+  char line[LINE_SIZE];
+  int length;
+
+  length = vsnprintf (line, sizeof (line), format, ap);
+  if (length <= 0)
+    return;
+  if ((size_t) length >= sizeof (line))
+    length = sizeof (line) - 1;
+
+  if (mm_ring_write (ring, line, length))
+    {
+      int value;
+      /* One wake up per drain is enough.  */
+      if (sem_getvalue (&_pending, &value) == 0 && value == 0)
+        sem_post (&_pending);
+    }
+  else
+    ++_dropped;
+}
+
+void
+mm_vprintf (const char *format, va_list ap)
+{
+  if (_ring == NULL)
+    vprintf (format, ap);
+  else
+    enqueue (_ring, format, ap);
+}
+
+void
+mm_eprintf (const char *format, ...)
+{
+  va_list ap;
+  va_start (ap, format);
+  if (_error_ring == NULL || !pthread_equal (pthread_self (), _main_thread))
+    vfprintf (stderr, format, ap);
+  else
+    enqueue (_error_ring, format, ap);
+  va_end (ap);
+}
+
+void
+mm_printf (const char *format, ...)
+{
+  va_list ap;
+  va_start (ap, format);
+  mm_vprintf (format, ap);
+  va_end (ap);
+}
+
+int
+mm_screen_width ()
+{
+  if (_width == 0)
+    update_width ();
+  return _width;
+}
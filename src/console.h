@@ -0,0 +1,41 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef MM_CONSOLE_H
+#define MM_CONSOLE_H 1
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+/* Decorative output is compiled out with MM_HEADLESS and skipped at run
+   time in headless mode.  Errors and reports are always printed.  */
+#ifdef MM_HEADLESS
+# define MM_UI false
+#else
+# define MM_UI (!mm_console_get_headless ())
+#endif
+
+void mm_console_start ();
+void mm_console_stop ();
+bool mm_console_get_headless ();
+void mm_console_set_headless (bool);
+void mm_printf (const char *, ...) __attribute__ ((format (printf, 1, 2)));
+void mm_vprintf (const char *, va_list);
+void mm_eprintf (const char *, ...) __attribute__ ((format (printf, 1, 2)));
+int mm_screen_width ();
+
+#endif /* ! MM_CONSOLE_H */
@@ -18,12 +18,37 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <signal.h>
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 
 #include "input.h"
+#include "recorder.h"
 #include "timer.h"
+#include "trace.h"
 #include "print.h"
 
 #define MAX_NUM_BACKENDS 8
+#define MAX_NUM_DEVICES 10
+
+/* Lost devices of hotplug backends are looked for again, off the event
+   loop, whenever something changes in /dev/input or at the latest after
+   this many ms.  PortMidi only lists its devices when initialized, and
+   doing that again would close the outputs playing, so a lost MIDI input
+   stays lost until MemfisMIDI is restarted.  */
+#define MM_RECONNECT_INTERVAL 1000
+#define MM_HOTPLUG_DIR "/dev/input"
+
+/* Continuous controls are emitted at most once per interval (ms), moved
+   towards the latest raw value by the smoothing factor and dropped when the
+   change is below the dead band.  */
+#define MM_CONTROL_INTERVAL 20
+#define MM_CONTROL_SMOOTHING 0.5
+#define MM_CONTROL_DEADBAND (1. / 256.)
 
 static size_t _nbackends = 0;
 static const MMInputBackend *_backends[MAX_NUM_BACKENDS];
@@ -31,13 +56,71 @@ static const MMInputBackend *_backends[MAX_NUM_BACKENDS];
 static bool mm_quit = false;
 static void mm_sa_handler (int);
 
+static const char *_event_names[MMIE_NUM_TYPES] = {
+  "quit",
+  "killall",
+  "next_step",
+  "prev_seq",
+  "next_seq",
+  "tap",
+  "tempo",
+  "expression",
+  "transpose",
+  "chord",
+  "clock",
+  "start",
+  "stop",
+  "nudge"
+};
+
+/* Continuous controls in the order they are smoothed in.  */
+static const MMInputEventType _controls[MMIE_NUM_CONTROLS] = {
+  MMIE_TEMPO,
+  MMIE_EXPRESSION,
+  MMIE_TRANSPOSE,
+  MMIE_NUDGE
+};
+
+typedef struct
+{
+  bool active;
+  double target;
+  double value;
+  unsigned int timestamp;
+  uint64_t time;
+  unsigned int last_emit;
+} MMInputControl;
+
 struct _MMInput
 {
   MMInputDevice device;
   const MMInputBackend *backend;
   void *connection;
+  MMTimer *timer;
+  MMRecorder *recorder;
+  unsigned int listening;  /* Of MMIE_OPTIONAL.  */
+  MMInputControl controls[MMIE_NUM_CONTROLS];
+  /* The scanner thread looks for the device once it is lost and hands
+     it over to be connected on the event loop.  */
+  pthread_t scanner;
+  bool scanning;
+  int hotplug_fd;  /* Own watch, so no other input eats its events.  */
+  int wake_fd;
+  pthread_mutex_t lock;
+  bool lost;       /* Guarded by LOCK, as are those below.  */
+  bool stop;
+  bool found;
+  MMInputDevice found_device;
 };
 
+static void lose (MMInput *);
+static void *scan (void *);
+static bool find_device (const MMInput *, MMInputDevice *);
+static bool reconnect (MMInput *);
+static int read_event (MMInput *, MMInputEvent *);
+static void control_update (MMInput *, const MMInputEvent *);
+static bool control_flush (MMInput *, MMInputEvent *);
+
 MMInput *
 mm_input_new (const MMInputDevice *device)
 {
@@ -73,6 +156,11 @@ mm_input_new (const MMInputDevice *device)
   memcpy (&input->device, device, sizeof (MMInputDevice));
   input->backend = backend;
   input->connection = connection;
+  input->timer = mm_timer_new ();
+  input->scanning = false;
+  input->hotplug_fd = -1;
+  input->wake_fd = -1;
+  pthread_mutex_init (&input->lock, NULL);
 
   sigaction (SIGINT, NULL, &sa);
   if (sa.sa_handler != mm_sa_handler)
@@ -89,24 +177,112 @@ mm_input_free (MMInput *input)
 {
   if (input != NULL)
     {
-      input->backend->disconnect (input->connection);
+      if (input->scanning)
+        {
+          pthread_mutex_lock (&input->lock);
+          input->stop = true;
+          pthread_mutex_unlock (&input->lock);
+          eventfd_write (input->wake_fd, 1);
+          pthread_join (input->scanner, NULL);
+          close (input->wake_fd);
+          if (input->hotplug_fd >= 0)
+            close (input->hotplug_fd);
+        }
+      pthread_mutex_destroy (&input->lock);
+      if (input->connection != NULL)
+        input->backend->disconnect (input->connection);
+      mm_timer_free (input->timer);
       free (input);
     }
 }
 
 int
-mm_input_read (const MMInput *input, MMInputEvent *event)
+mm_input_read (MMInput *input, MMInputEvent *event)
 {
+  MM_TRACE_BEGIN (start);
+  int nread = read_event (input, event);
+
+  if (nread > 0 && input != NULL)
+    {
+      /* Empty polls would flood the trace.  */
+      MM_TRACE_END (MMTP_INPUT_READ, start, event->type);
+      mm_recorder_record (input->recorder, event);
+    }
+
+  return nread;
+}
+
+/* Reads the events of MMIE_OPTIONAL in EVENTS too, dropping the rest of
+   them.  */
+void
+mm_input_listen (MMInput *input, unsigned int events)
+{
+  if (input == NULL)
+    return;
+
+  input->listening = events & MMIE_OPTIONAL;
+  if (input->connection != NULL && input->backend->listen != NULL)
+    input->backend->listen (input->connection, input->listening);
+}
+
+void
+mm_input_set_recorder (MMInput *input, MMRecorder *recorder)
+{
+  if (input != NULL)
+    input->recorder = recorder;
+}
+
+static int
+read_event (MMInput *input, MMInputEvent *event)
+{
+  int nread;
+
   if (mm_quit == true && event != NULL)
     {
       mm_quit = false;
       event->type = MMIE_QUIT;
+      event->value = 0.;
+      event->time = mm_time_us ();
       return 1;
     }
-  else if (input != NULL && event != NULL)
-    return input->backend->read (input->connection, event);
+  else if (input == NULL || event == NULL)
+    return -1;
+
+  if (input->connection == NULL && !reconnect (input))
+    return 0;
+
+  /* Momentary events pass straight through while control streams are
+     coalesced and released at a limited rate.  */
+  for (event->time = 0;
+       (nread = input->backend->read (input->connection, event)) > 0;
+       event->time = 0)
+    {
+      /* Backends that know better may stamp the time themselves.  */
+      if (event->time == 0)
+        event->time = mm_time_us ();
+      if (MMIE_BIT (event->type) & MMIE_OPTIONAL & ~input->listening)
+        continue;
+      if (!mm_input_is_control (event->type) || input->backend->smoothed)
+        return nread;
+      control_update (input, event);
+    }
 
-  return -1;
+  if (nread < 0)
+    {
+      MMERR ("Input " MMCY ("%s") " lost", input->device.name);
+      input->backend->disconnect (input->connection);
+      input->connection = NULL;
+      if (input->backend->hotplug)
+        lose (input);
+      else
+        MMERR ("Restart to reconnect " MMCY ("%s"), input->device.name);
+      nread = 0;
+    }
+
+  if (control_flush (input, event))
+    return 1;
+
+  return nread;
 }
 
 const char *
@@ -166,7 +342,7 @@ mm_input_list_devices (MMInputDevice *devices, size_t ndevices)
 MMInput *
 mm_input_autodetect ()
 {
-  size_t ndevices = 10;
+  size_t ndevices = MAX_NUM_DEVICES;
   size_t ncandidates = 0;
   MMInputDevice devices[ndevices];
   MMInput *candidates[ndevices];
@@ -218,6 +394,240 @@ mm_input_autodetect ()
   return NULL;
 }
 
+/* Has the scanner look for the device of INPUT, starting it the first
+   time.  */
+static void
+lose (MMInput *input)
+{
+  pthread_mutex_lock (&input->lock);
+  input->lost = true;
+  input->found = false;
+  pthread_mutex_unlock (&input->lock);
+
+  if (input->scanning)
+    {
+      eventfd_write (input->wake_fd, 1);
+      return;
+    }
+
+  input->wake_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (input->wake_fd < 0)
+    {
+      MMERR ("Could not watch for " MMCY ("%s"), input->device.name);
+      return;
+    }
+
+  input->hotplug_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (input->hotplug_fd >= 0
+      && inotify_add_watch (input->hotplug_fd, MM_HOTPLUG_DIR,
+                            IN_CREATE | IN_ATTRIB) < 0)
+    {
+      close (input->hotplug_fd);
+      input->hotplug_fd = -1;
+    }
+
+  if (pthread_create (&input->scanner, NULL, scan, input) != 0)
+    {
+      MMERR ("Could not watch for " MMCY ("%s"), input->device.name);
+      close (input->wake_fd);
+      if (input->hotplug_fd >= 0)
+        close (input->hotplug_fd);
+      input->hotplug_fd = -1;
+      return;
+    }
+
+  input->scanning = true;
+}
+
+/* The scanner thread.  Probes while the device is lost, then waits for
+   a hotplug event, the interval or a wake up.  */
+static void *
+scan (void *data)
+{
+  MMInput *input = (MMInput *) data;
+  char buf[sizeof (struct inotify_event) + NAME_MAX + 1]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  struct pollfd fds[2] = {
+    { input->wake_fd, POLLIN, 0 },
+    { input->hotplug_fd, POLLIN, 0 }
+  };
+  eventfd_t wakes;
+
+  for (;;)
+    {
+      MMInputDevice device;
+      bool wanted;
+
+      pthread_mutex_lock (&input->lock);
+      if (input->stop)
+        {
+          pthread_mutex_unlock (&input->lock);
+          break;
+        }
+      wanted = input->lost && !input->found;
+      pthread_mutex_unlock (&input->lock);
+
+      if (wanted && find_device (input, &device))
+        {
+          pthread_mutex_lock (&input->lock);
+          if (input->lost)
+            {
+              input->found_device = device;
+              input->found = true;
+            }
+          pthread_mutex_unlock (&input->lock);
+        }
+
+      poll (fds, input->hotplug_fd >= 0 ? 2 : 1, MM_RECONNECT_INTERVAL);
+      eventfd_read (input->wake_fd, &wakes);
+      if (input->hotplug_fd >= 0)
+        while (read (input->hotplug_fd, buf, sizeof (buf)) > 0);
+    }
+
+  return NULL;
+}
+
+/* Device ids may change between connections, names should not.  */
+static bool
+find_device (const MMInput *input, MMInputDevice *device)
+{
+  MMInputDevice devices[MAX_NUM_DEVICES];
+  size_t ndevices = input->backend->probe (devices, MAX_NUM_DEVICES);
+
+  for (size_t i = 0; i < ndevices; ++i)
+    {
+      if (strcmp (devices[i].name, input->device.name) == 0)
+        {
+          *device = devices[i];
+          return true;
+        }
+    }
+
+  return false;
+}
+
+/* Connects the device the scanner found, if any.  */
+static bool
+reconnect (MMInput *input)
+{
+  MMInputDevice device;
+  bool found;
+
+  pthread_mutex_lock (&input->lock);
+  found = input->found;
+  if (found)
+    {
+      device = input->found_device;
+      input->found = false;
+    }
+  pthread_mutex_unlock (&input->lock);
+
+  if (!found)
+    return false;
+
+  input->connection = input->backend->connect (&device);
+  if (input->connection == NULL)
+    return false;
+  if (input->backend->listen != NULL)
+    input->backend->listen (input->connection, input->listening);
+
+  pthread_mutex_lock (&input->lock);
+  input->lost = false;
+  pthread_mutex_unlock (&input->lock);
+
+  input->device.id = device.id;
+  mm_print_cmd ("INPUT", true);
+  MMUI (MMCB ("%s") "\n", input->device.name);
+  mm_print_cmd_end ();
+  return true;
+}
+
+static void
+control_update (MMInput *input, const MMInputEvent *event)
+{
+  MMInputControl *control;
+  size_t i = 0;
+
+  while (_controls[i] != event->type)
+    ++i;
+  control = &input->controls[i];
+
+  if (!control->active)
+    {
+      /* First reading; emit without smoothing.  */
+      control->active = true;
+      control->value = -1.;
+      control->last_emit = mm_timer_get_age (input->timer)
+                           - MM_CONTROL_INTERVAL;
+    }
+
+  control->target = fmin (fmax (event->value, 0.), 1.);
+  control->timestamp = event->timestamp;
+  control->time = event->time;
+}
+
+static bool
+control_flush (MMInput *input, MMInputEvent *event)
+{
+  unsigned int now = mm_timer_get_age (input->timer);
+
+  for (int i = 0; i < MMIE_NUM_CONTROLS; ++i)
+    {
+      MMInputControl *control = &input->controls[i];
+      double value;
+
+      if (!control->active || now - control->last_emit < MM_CONTROL_INTERVAL)
+        continue;
+
+      if (control->value < 0.)
+        value = control->target;
+      else
+        {
+          value = control->value
+            + MM_CONTROL_SMOOTHING * (control->target - control->value);
+          if (fabs (control->target - value) < MM_CONTROL_DEADBAND)
+            value = control->target;
+        }
+
+      if (fabs (value - control->value) < MM_CONTROL_DEADBAND)
+        continue;
+
+      control->value = value;
+      control->last_emit = now;
+
+      event->type = _controls[i];
+      event->timestamp = control->timestamp;
+      event->value = value;
+      event->time = control->time;
+      return true;
+    }
+
+  return false;
+}
+
+const char *
+mm_input_event_name (MMInputEventType type)
+{
+  if (type < 0 || type >= MMIE_NUM_TYPES)
+    return "unknown";
+  return _event_names[type];
+}
+
+MMInputEventType
+mm_input_event_type (const char *name)
+{
+  if (name != NULL)
+    {
+      for (int i = 0; i < MMIE_NUM_TYPES; ++i)
+        {
+          if (strcmp (_event_names[i], name) == 0)
+            return (MMInputEventType) i;
+        }
+    }
+
+  return MMIE_NUM_TYPES;
+}
+
 static void
 mm_sa_handler (int sig)
 {
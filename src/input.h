@@ -19,8 +19,11 @@
 #define MM_INPUT_H 1
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct _MMInput MMInput;
+typedef struct _MMRecorder MMRecorder;
 
 typedef enum
 {
@@ -30,13 +33,43 @@ typedef enum
   MMIE_PREV_SEQ,
   MMIE_NEXT_SEQ,
   MMIE_TAP,
+  MMIE_TEMPO,
+  MMIE_EXPRESSION,
+  MMIE_TRANSPOSE,
+  MMIE_CHORD,
+  MMIE_CLOCK,
+  MMIE_START,
+  MMIE_STOP,
+  MMIE_NUDGE,
   MMIE_NUM_TYPES
 } MMInputEventType;
 
+/* Continuous controls carry a VALUE normalized to [0, 1].  New types go
+   last, so they are listed in mm_input_is_control.  */
+#define MMIE_NUM_CONTROLS 4
+
+/* MMIE_NUDGE comes from self-centering controls, 0.5 at rest.  */
+
+/* MMIE_CHORD carries the pitch classes held as a 12 bit mask in VALUE,
+   plus the pitch class of the bass times MMIE_CHORD_BASS.  */
+#define MMIE_CHORD_BASS 4096
+
+/* MMIE_START has a VALUE of 1 to start over and 0 to continue.  */
+
+/* Chords played and clock are only read once asked for with
+   mm_input_listen, as inputs often send them for other gear.  */
+#define MMIE_BIT(type) (1u << (type))
+#define MMIE_OPTIONAL (MMIE_BIT (MMIE_CHORD) | MMIE_BIT (MMIE_CLOCK) \
+                       | MMIE_BIT (MMIE_START) | MMIE_BIT (MMIE_STOP))
+
+/* TIMESTAMP is in the backend's own time base while TIME is when the
+   event entered MemfisMIDI, in mm_time_us () microseconds.  */
 typedef struct
 {
   MMInputEventType type;
   unsigned int timestamp;
+  double value;
+  uint64_t time;
 } MMInputEvent;
 
 typedef struct
@@ -53,14 +86,39 @@ typedef struct
   void (*disconnect) (void *);
   int (*read) (void *, MMInputEvent *);
   size_t (*probe) (MMInputDevice *, size_t);
+  /* Optional, told which of MMIE_OPTIONAL to read.  */
+  void (*listen) (void *, unsigned int);
+  /* Controls come already smoothed, as when replaying a recording.  */
+  bool smoothed;
+  /* Lost devices can be found again, as evdev ones show up anew.  */
+  bool hotplug;
 } MMInputBackend;
 
+static inline bool
+mm_input_is_control (MMInputEventType type)
+{
+  switch (type)
+    {
+    case MMIE_TEMPO:
+    case MMIE_EXPRESSION:
+    case MMIE_TRANSPOSE:
+    case MMIE_NUDGE:
+      return true;
+    default:
+      return false;
+    }
+}
+
 MMInput *mm_input_new (const MMInputDevice *);
 void mm_input_free (MMInput *);
-int mm_input_read (const MMInput *, MMInputEvent *);
+int mm_input_read (MMInput *, MMInputEvent *);
 const char *mm_input_get_name (const MMInput *);
+void mm_input_set_recorder (MMInput *, MMRecorder *);
+void mm_input_listen (MMInput *, unsigned int);
 bool mm_input_register_backend (const MMInputBackend *);
 size_t mm_input_list_devices (MMInputDevice *, size_t);
 MMInput *mm_input_autodetect ();
+const char *mm_input_event_name (MMInputEventType);
+MMInputEventType mm_input_event_type (const char *);
 
 #endif /* ! MM_INPUT_H */
@@ -36,6 +36,8 @@ typedef struct
   int fd;
   uint8_t nbuttons;
   uint16_t map[MAP_LENGTH];
+  uint8_t naxes;
+  uint8_t axmap[ABS_CNT];
 } MMInputJoystick;
 
 enum {
@@ -124,6 +126,12 @@ mm_input_joystick_connect (const MMInputDevice *device)
   if (ioctl (input->fd, JSIOCGBTNMAP, input->map) < 0)
     MMERR ("Could not get button map: ERRNO " MMCY ("%d"), errno);
 
+  if (ioctl (input->fd, JSIOCGAXES, &input->naxes) < 0)
+    MMERR ("Could not get axis count: ERRNO " MMCY ("%d"), errno);
+
+  if (ioctl (input->fd, JSIOCGAXMAP, input->axmap) < 0)
+    MMERR ("Could not get axis map: ERRNO " MMCY ("%d"), errno);
+
   return input;
 }
 
@@ -145,11 +153,12 @@ mm_input_joystick_read (void *connection, MMInputEvent *event)
 {
   MMInputJoystick *input = (MMInputJoystick *) connection;
   struct js_event e;
+  ssize_t nread;
 
   if (input == NULL || input->fd < 0 || event == NULL)
     return -1;
 
-  while (read (input->fd, &e, sizeof (e)) > 0)
+  while ((nread = read (input->fd, &e, sizeof (e))) > 0)
     {
       if (e.type & JS_EVENT_INIT)
         continue;
@@ -183,10 +192,39 @@ mm_input_joystick_read (void *connection, MMInputEvent *event)
               continue;
             }
           event->timestamp = e.time;
+          event->value = 1.;
+          return 1;
+        }
+      else if ((e.type & JS_EVENT_AXIS) && e.number < input->naxes)
+        {
+          /* Sticks read -32767 when pushed up.  They spring back, so the
+             tempo is nudged rather than set.  */
+          switch (input->axmap[e.number])
+            {
+            case ABS_RY:
+              event->type = MMIE_NUDGE;
+              event->value = (32767. - e.value) / 65534.;
+              break;
+            case ABS_Y:
+              event->type = MMIE_EXPRESSION;
+              event->value = (32767. - e.value) / 65534.;
+              break;
+            case ABS_RX:
+              event->type = MMIE_TRANSPOSE;
+              event->value = (e.value + 32767.) / 65534.;
+              break;
+            default:
+              continue;
+            }
+          event->timestamp = e.time;
           return 1;
         }
     }
 
+  /* ENODEV once the device has been unplugged.  */
+  if (nread < 0 && errno != EAGAIN && errno != EINTR)
+    return -1;
+
   return 0;
 }
 
@@ -220,7 +258,10 @@ static const MMInputBackend _mm_input_joystick_backend = {
   mm_input_joystick_connect,
   mm_input_joystick_disconnect,
   mm_input_joystick_read,
-  mm_input_joystick_probe
+  mm_input_joystick_probe,
+  NULL,
+  false,
+  true
 };
 
 const MMInputBackend *mm_input_joystick_backend = &_mm_input_joystick_backend;
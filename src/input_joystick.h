@@ -20,6 +20,6 @@
 
 #include "input.h"
 
-const MMInputBackend *mm_input_joystick_backend;
+extern const MMInputBackend *mm_input_joystick_backend;
 
 #endif /* ! MM_INPUT_JOYSTICK_H */
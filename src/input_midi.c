@@ -21,13 +21,72 @@
 #include <portmidi.h>
 
 #include "input_midi.h"
+#include "timer.h"
 #include "print.h"
 
+enum {
+  MMMIDI_CC_EXPRESSION = 0x0B,
+  MMMIDI_CC_TEMPO = 0x10,     /* General Purpose 1.  */
+  MMMIDI_CC_TRANSPOSE = 0x11  /* General Purpose 2.  */
+};
+
 typedef struct {
   PortMidiStream *stream;
   int last_ts;
+  uint64_t start;
+  unsigned char held[128];
 } MMInputMidi;
 
+static PmTimestamp
+mm_input_midi_time_proc (void *time_info)
+{
+  const MMInputMidi *input = (const MMInputMidi *) time_info;
+  return (PmTimestamp) ((mm_time_us () - input->start) / 1000);
+}
+
+/* The pitch classes of the notes held and the bass, see MMIE_CHORD.  */
+static double
+held_chord (const MMInputMidi *input)
+{
+  unsigned int mask = 0;
+  int bass = -1;
+
+  for (int note = 0; note < 128; ++note)
+    {
+      if (input->held[note] > 0)
+        {
+          mask |= 1 << (note % 12);
+          if (bass < 0)
+            bass = note % 12;
+        }
+    }
+
+  return (double) (mask + (bass >= 0 ? bass : 0) * MMIE_CHORD_BASS);
+}
+
+/* Filters everything except PM_FILT_PROGRAM and PM_FILT_CONTROL, and
+   PM_FILT_NOTE, PM_FILT_CLOCK and PM_FILT_PLAY unless EVENTS asks for
+   what they carry.  */
+static void
+mm_input_midi_listen (void *connection, unsigned int events)
+{
+  MMInputMidi *input = (MMInputMidi *) connection;
+  int32_t filter = PM_FILT_ACTIVE | PM_FILT_SYSEX
+    | PM_FILT_TICK | PM_FILT_FD | PM_FILT_UNDEFINED | PM_FILT_RESET
+    | PM_FILT_CHANNEL_AFTERTOUCH | PM_FILT_POLY_AFTERTOUCH
+    | PM_FILT_PITCHBEND | PM_FILT_MTC
+    | PM_FILT_SONG_POSITION | PM_FILT_SONG_SELECT | PM_FILT_TUNE;
+
+  if ((events & MMIE_BIT (MMIE_CHORD)) == 0)
+    filter |= PM_FILT_NOTE;
+  if ((events & MMIE_BIT (MMIE_CLOCK)) == 0)
+    filter |= PM_FILT_CLOCK;
+  if ((events & (MMIE_BIT (MMIE_START) | MMIE_BIT (MMIE_STOP))) == 0)
+    filter |= PM_FILT_PLAY;
+
+  Pm_SetFilter (input->stream, filter);
+}
+
 static void *
 mm_input_midi_connect (const MMInputDevice *device)
 {
@@ -38,26 +97,24 @@ mm_input_midi_connect (const MMInputDevice *device)
   if (device == NULL)
     return NULL;
 
-  err = Pm_OpenInput (&stream, device->id, NULL, 32, NULL, NULL);
+  input = calloc (1, sizeof (MMInputMidi));
+  assert (input != NULL);
+  input->start = mm_time_us ();
+
+  /* Timestamps in ms since START, room for a few ticks of clock.  */
+  err = Pm_OpenInput (&stream, device->id, NULL, 256,
+                      mm_input_midi_time_proc, input);
   if (err < pmNoError || stream == NULL)
     {
       MMERR ("MIDI Device " MMCY ("%d") " could not be opened: " MMCY ("%s"),
              device->id, Pm_GetErrorText (err));
+      free (input);
       return NULL;
     }
 
-  /* Filter everything except PM_FILT_PROGRAM.  */
-  Pm_SetFilter (stream, PM_FILT_ACTIVE | PM_FILT_SYSEX | PM_FILT_CLOCK
-                | PM_FILT_PLAY | PM_FILT_TICK | PM_FILT_FD | PM_FILT_UNDEFINED
-                | PM_FILT_FD | PM_FILT_RESET | PM_FILT_NOTE
-                | PM_FILT_CHANNEL_AFTERTOUCH | PM_FILT_POLY_AFTERTOUCH
-                | PM_FILT_CONTROL | PM_FILT_PITCHBEND | PM_FILT_MTC
-                | PM_FILT_SONG_POSITION | PM_FILT_SONG_SELECT | PM_FILT_TUNE);
-
-  input = calloc (1, sizeof (MMInputMidi));
-  assert (input != NULL);
   input->stream = stream;
   input->last_ts = -1;
+  mm_input_midi_listen (input, 0);
 
   return input;
 }
@@ -123,19 +180,89 @@ mm_input_midi_read (void *connection, MMInputEvent *event)
 
           input->last_ts = e.timestamp;
           event->timestamp = (unsigned int) e.timestamp;
+          event->value = 1.;
+          return 1;
+
+        case 0xB0:
+
+          switch (Pm_MessageData1 (e.message))
+            {
+            case MMMIDI_CC_EXPRESSION:
+              event->type = MMIE_EXPRESSION;
+              break;
+            case MMMIDI_CC_TEMPO:
+              event->type = MMIE_TEMPO;
+              break;
+            case MMMIDI_CC_TRANSPOSE:
+              event->type = MMIE_TRANSPOSE;
+              break;
+            default:
+              /* Mod wheel, sustain and the like are not ours.  */
+              continue;
+            }
+
+          event->timestamp = (unsigned int) e.timestamp;
+          event->value = (double) Pm_MessageData2 (e.message) / 127.;
+          return 1;
+
+        case 0x90:
+        case 0x80:
+          {
+            unsigned char *held = &input->held[Pm_MessageData1 (e.message)
+                                               & 0x7F];
+
+            /* Only chords struck are of interest.  */
+            if (Pm_MessageStatus (e.message) == 0x80
+                || Pm_MessageData2 (e.message) == 0)
+              {
+                if (*held > 0)
+                  --*held;
+                continue;
+              }
+
+            if (*held < 0xFF)
+              ++*held;
+          }
+
+          event->type = MMIE_CHORD;
+          event->timestamp = (unsigned int) e.timestamp;
+          event->value = held_chord (input);
+          return 1;
+
+        case 0xF8:
+        case 0xFA:
+        case 0xFB:
+        case 0xFC:
+          switch (Pm_MessageStatus (e.message))
+            {
+            case 0xF8:
+              event->type = MMIE_CLOCK;
+              break;
+            case 0xFC:
+              event->type = MMIE_STOP;
+              break;
+            default:
+              event->type = MMIE_START;
+              break;
+            }
+
+          /* Clock follows arrival times, not when they were read.  */
+          event->timestamp = (unsigned int) e.timestamp;
+          event->time = input->start + (uint64_t) e.timestamp * 1000;
+          /* Continue does not rewind.  */
+          event->value = (Pm_MessageStatus (e.message) == 0xFB) ? 0. : 1.;
           return 1;
 
         default:
-          MMERR ("Unhandled message status " MMCY ("0x%X, 0x%X, 0x%X"),
-                 Pm_MessageStatus (e.message),
-                 Pm_MessageData1 (e.message),
-                 Pm_MessageData2 (e.message));
+          /* Other channels and whatever got past the filter.  */
           continue;
         }
     }
 
   if (nread == pmBufferOverflow)
     MMERR ("Input buffer overflow");
+  else if (nread < pmNoError)
+    return -1;
 
   return 0;
 }
@@ -168,7 +295,10 @@ static const MMInputBackend _mm_input_midi_backend = {
   mm_input_midi_connect,
   mm_input_midi_disconnect,
   mm_input_midi_read,
-  mm_input_midi_probe
+  mm_input_midi_probe,
+  mm_input_midi_listen,
+  false,
+  false
 };
 
 const MMInputBackend *mm_input_midi_backend = &_mm_input_midi_backend;
@@ -20,6 +20,6 @@
 
 #include "input.h"
 
-const MMInputBackend *mm_input_midi_backend;
+extern const MMInputBackend *mm_input_midi_backend;
 
 #endif /* ! MM_INPUT_MIDI_H */
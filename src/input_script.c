@@ -0,0 +1,282 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "input_script.h"
+#include "recorder.h"
+#include "timer.h"
+#include "print.h"
+
+/* Replays a text script of timestamped events, one per line:
+
+     # ms     event       [value]
+     0        next_step
+     500      tempo       0.4
+     1000     quit
+
+   Times are in ms from the first read and must not decrease.  Files
+   written by the recorder are replayed as well, with us precision, and
+   controls, recorded once smoothed, are not smoothed again.  Once
+   the script is exhausted a quit event is injected so runs always end.  */
+
+#define MAX_LINE_LENGTH 128
+
+typedef struct
+{
+  uint64_t time; /* us.  */
+  unsigned int timestamp;
+  MMInputEventType type;
+  double value;
+} MMScriptEvent;
+
+typedef struct
+{
+  MMScriptEvent *events;
+  size_t nevents;
+  size_t current;
+  uint64_t start;
+} MMInputScript;
+
+static MMScriptEvent *
+add_event (MMInputScript *input, size_t *size)
+{
+  if (input->nevents == *size)
+    {
+      *size *= 2;
+      input->events = realloc (input->events, *size * sizeof (MMScriptEvent));
+      assert (input->events != NULL);
+    }
+
+  return &input->events[input->nevents];
+}
+
+static bool
+parse_line (char *line, MMScriptEvent *event)
+{
+  char name[32];
+  unsigned int ms;
+  int nfields;
+
+  event->value = 1.;
+  nfields = sscanf (line, "%u %31s %lf", &ms, name, &event->value);
+  if (nfields < 2)
+    return false;
+
+  event->time = (uint64_t) ms * 1000;
+  event->timestamp = ms;
+  event->type = mm_input_event_type (name);
+  return event->type < MMIE_NUM_TYPES;
+}
+
+static void
+load_text (MMInputScript *input, FILE *file)
+{
+  char line[MAX_LINE_LENGTH];
+  size_t size = 64;
+  unsigned int lineno = 0;
+
+  while (fgets (line, sizeof (line), file) != NULL)
+    {
+      char *c = line + strspn (line, " \t");
+      MMScriptEvent *event;
+
+      ++lineno;
+      if (*c == '#' || *c == '\n' || *c == '\0')
+        continue;
+
+      event = add_event (input, &size);
+      if (!parse_line (c, event))
+        {
+          MMERR ("Invalid event on line " MMCY ("%u"), lineno);
+          continue;
+        }
+
+      if (input->nevents > 0 && event->time < (event - 1)->time)
+        {
+          MMERR ("Event on line " MMCY ("%u") " is out of order", lineno);
+          continue;
+        }
+
+      ++input->nevents;
+    }
+}
+
+static bool
+load_recording (MMInputScript *input, FILE *file)
+{
+  unsigned char header[MM_RECORDER_HEADER_SIZE];
+  unsigned char record[MM_RECORDER_RECORD_SIZE];
+  unsigned int version, nrecords = 0;
+  size_t size = 64;
+
+  if (fread (header, 1, sizeof (header), file) != sizeof (header))
+    {
+      MMERR ("Truncated recording header");
+      return false;
+    }
+
+  version = mm_recorder_get_version (header);
+  if (version == 0 || version > MM_RECORDER_VERSION)
+    {
+      MMERR ("Unsupported recording version " MMCY ("%u"), version);
+      return false;
+    }
+
+  while (fread (record, 1, sizeof (record), file) == sizeof (record))
+    {
+      MMInputEvent decoded;
+      MMScriptEvent *event;
+
+      ++nrecords;
+      if (!mm_recorder_decode (record, version, &decoded))
+        {
+          MMERR ("Invalid event in record " MMCY ("%u"), nrecords);
+          continue;
+        }
+
+      event = add_event (input, &size);
+      event->time = decoded.time;
+      event->timestamp = decoded.timestamp;
+      event->type = decoded.type;
+      event->value = decoded.value;
+      ++input->nevents;
+    }
+
+  return true;
+}
+
+static void *
+mm_input_script_connect (const MMInputDevice *device)
+{
+  MMInputScript *input;
+  FILE *file;
+  char magic[4];
+
+  if (device == NULL)
+    return NULL;
+
+  file = fopen (device->name, "rb");
+  if (file == NULL)
+    {
+      MMERR ("Failed to open " MMCY ("%s"), device->name);
+      return NULL;
+    }
+
+  input = calloc (1, sizeof (MMInputScript));
+  assert (input != NULL);
+  input->events = malloc (64 * sizeof (MMScriptEvent));
+  assert (input->events != NULL);
+
+  if (fread (magic, 1, sizeof (magic), file) == sizeof (magic)
+      && memcmp (magic, MM_RECORDER_MAGIC, sizeof (magic)) == 0)
+    {
+      rewind (file);
+      if (!load_recording (input, file))
+        {
+          fclose (file);
+          free (input->events);
+          free (input);
+          return NULL;
+        }
+    }
+  else
+    {
+      rewind (file);
+      load_text (input, file);
+    }
+
+  fclose (file);
+
+  return input;
+}
+
+static void
+mm_input_script_disconnect (void *connection)
+{
+  MMInputScript *input = (MMInputScript *) connection;
+  if (input == NULL)
+    return;
+
+  free (input->events);
+  free (input);
+}
+
+static int
+mm_input_script_read (void *connection, MMInputEvent *event)
+{
+  MMInputScript *input = (MMInputScript *) connection;
+  const MMScriptEvent *next;
+  uint64_t now = mm_time_us ();
+
+  if (input == NULL || event == NULL)
+    return -1;
+
+  if (input->start == 0)
+    input->start = now;
+
+  if (input->current > input->nevents)
+    return 0;
+
+  if (input->current == input->nevents)
+    {
+      ++input->current;
+      event->type = MMIE_QUIT;
+      event->timestamp = (now - input->start) / 1000;
+      event->value = 0.;
+      event->time = now;
+      return 1;
+    }
+
+  next = &input->events[input->current];
+  if (now - input->start < next->time)
+    return 0;
+
+  ++input->current;
+  event->type = next->type;
+  event->timestamp = next->timestamp;
+  event->value = next->value;
+  /* Latency is measured from when the event was due.  */
+  event->time = input->start + next->time;
+
+  return 1;
+}
+
+static size_t
+mm_input_script_probe (MMInputDevice *devices, size_t ndevices)
+{
+  /* Scripts are picked explicitly, never autodetected.  */
+  (void) devices;
+  (void) ndevices;
+  return 0;
+}
+
+static const MMInputBackend _mm_input_script_backend = {
+  "SCRIPT",
+  mm_input_script_connect,
+  mm_input_script_disconnect,
+  mm_input_script_read,
+  mm_input_script_probe,
+  NULL,
+  true,
+  false
+};
+
+const MMInputBackend *mm_input_script_backend = &_mm_input_script_backend;
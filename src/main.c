@@ -16,33 +16,255 @@
    along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <stdlib.h>
+#include <getopt.h>
 
 #include <portmidi.h>
 
 #include "app.h"
+#include "console.h"
 #include "input.h"
 #include "input_joystick.h"
 #include "input_midi.h"
+#include "input_script.h"
+#include "output.h"
+#include "output_capture.h"
+#include "output_midi.h"
+#include "output_null.h"
+#include "output_smf.h"
 #include "player.h"
 #include "program.h"
 #include "program_factory.h"
+#include "recorder.h"
+#include "smf_import.h"
+#include "render.h"
+#include "timer.h"
+#include "trace.h"
 #include "print.h"
 
-static PmDeviceID
-mm_get_output_device_id (const char *input_name)
+#define MAX_NUM_DEVICES 16
+#define MAX_NUM_CLOCKS 8
+#define MAX_NUM_PORTS 7
+#define DIN_BAUD 31250
+
+/* Clock jitter allowed on DIN wires, us.  0 models no wire.  */
+static unsigned int _din_bound = 0;
+
+/* SPEC is either a backend name optionally followed by ":NAME", like
+   "null" or "capture:out.txt", or the name of a probed device.  Without a
+   SPEC the last device not named like the input is picked.  */
+static bool
+mm_get_output_device (const char *input_name, const char *spec,
+                      MMOutputDevice *device)
+{
+  MMOutputDevice devices[MAX_NUM_DEVICES];
+  size_t ndevices;
+  const char *name = NULL;
+
+  if (spec != NULL)
+    {
+      const char *colon = strchr (spec, ':');
+      char type[32];
+
+      snprintf (type, sizeof (type), "%.*s",
+                (int) (colon != NULL ? (size_t) (colon - spec)
+                                     : strlen (spec)),
+                spec);
+      if (mm_output_get_backend (type) != NULL)
+        {
+          device->type = mm_output_get_backend (type)->name;
+          device->id = 0;
+          snprintf (device->name, sizeof (device->name), "%s",
+                    colon != NULL ? colon + 1 : "");
+          if (strcmp (device->type, mm_output_midi_backend->name) != 0)
+            goto found;
+          name = device->name;
+        }
+      else
+        name = spec;
+    }
+
+  ndevices = mm_output_list_devices (devices, MAX_NUM_DEVICES);
+  for (size_t i = ndevices; i-- > 0;)
+    {
+      if ((name != NULL && strcmp (devices[i].name, name) == 0)
+          || (name == NULL && strcmp (devices[i].name, input_name) != 0))
+        {
+          memcpy (device, &devices[i], sizeof (MMOutputDevice));
+          goto found;
+        }
+    }
+
+  return false;
+
+ found:
+  mm_printf_subtitle ("INPUT / OUTPUT\n"
+                      MMCB ("%.32s") "\n" MMCB ("%.32s"),
+                      input_name,
+                      device->name[0] != '\0' ? device->name : device->type);
+  return true;
+}
+
+/* Opens the output NAME of a "NAME[,...]" SPEC as for --output, "-" being
+   the output itself and giving NULL.  Returns the rest of SPEC.  */
+static const char *
+mm_open_output (const char *input_name, const char *spec, MMOutput **output)
+{
+  MMOutputDevice device;
+  const char *comma = strchr (spec, ',');
+  char name[128];
+
+  snprintf (name, sizeof (name), "%.*s",
+            (int) (comma != NULL ? (size_t) (comma - spec) : strlen (spec)),
+            spec);
+
+  *output = NULL;
+  if (strcmp (name, "-") != 0)
+    {
+      if (!mm_get_output_device (input_name, name, &device))
+        {
+          MMERR ("No output device " MMCY ("%s") " found", name);
+          return NULL;
+        }
+      *output = mm_output_new (&device);
+      if (*output == NULL)
+        return NULL;
+      if (_din_bound > 0)
+        mm_output_set_wire (*output, DIN_BAUD, _din_bound);
+    }
+
+  return comma != NULL ? comma : "";
+}
+
+/* Opens SPEC, a device as for --output, as the next port notes can be
+   routed to.  */
+static bool
+mm_add_port (MMPlayer *player, const char *input_name, const char *spec)
+{
+  MMOutput *output;
+  const char *rest = mm_open_output (input_name, spec, &output);
+
+  if (rest == NULL)
+    return false;
+
+  if (output == NULL || *rest != '\0')
+    {
+      MMERR ("Invalid port " MMCY ("%s"), spec);
+      mm_output_free (output);
+      return false;
+    }
+
+  if (mm_player_add_port (player, output) < 0)
+    {
+      mm_output_free (output);
+      return false;
+    }
+
+  return true;
+}
+
+/* SPEC is "DEVICE[,OFFSET[,PPQN]]".  */
+static bool
+mm_add_clock (MMPlayer *player, const char *input_name, const char *spec)
+{
+  MMOutput *output;
+  const char *comma = mm_open_output (input_name, spec, &output);
+  int offset = 0;
+  int ppqn = 24;
+  char *endptr;
+
+  if (comma == NULL)
+    return false;
+
+  if (*comma == ',')
+    {
+      offset = (int) strtol (comma + 1, &endptr, 10);
+      if (*endptr == ',')
+        ppqn = (int) strtol (endptr + 1, &endptr, 10);
+      if (*endptr != '\0')
+        {
+          MMERR ("Invalid clock " MMCY ("%s"), spec);
+          mm_output_free (output);
+          return false;
+        }
+    }
+
+  if (!mm_player_set_clock (player, output, offset, ppqn))
+    {
+      mm_output_free (output);
+      return false;
+    }
+
+  return true;
+}
+
+/* SPEC is "DEVICE[,FPS]".  */
+static bool
+mm_set_timecode (MMPlayer *player, const char *input_name, const char *spec)
 {
-  for (PmDeviceID id = Pm_CountDevices () - 1; id >= 0; --id)
+  MMOutput *output;
+  const char *comma = mm_open_output (input_name, spec, &output);
+  int fps = 30;
+  char *endptr;
+
+  if (comma == NULL)
+    return false;
+
+  if (*comma == ',')
     {
-      const PmDeviceInfo *dev = Pm_GetDeviceInfo (id);
-      if ((dev->output == 1) && (strcmp (dev->name, input_name) != 0))
+      fps = (int) strtol (comma + 1, &endptr, 10);
+      if (*endptr != '\0')
         {
-          mm_printf_subtitle ("INPUT / OUTPUT\n"
-                              MMCB ("%.32s") "\n" MMCB ("%.32s"),
-                              input_name, dev->name);
-          return id;
+          MMERR ("Invalid time code " MMCY ("%s"), spec);
+          mm_output_free (output);
+          return false;
         }
     }
-  return pmNoDevice;
+
+  if (!mm_player_set_timecode (player, output, fps))
+    {
+      mm_output_free (output);
+      return false;
+    }
+
+  return true;
+}
+
+static void
+mm_usage (const char *name)
+{
+  fprintf (stderr, "Usage: %s [OPTION]... FILE...\n"
+           "  -c, --chords         select steps by the chords played on a\n"
+           "                       MIDI input\n"
+           "  -C, --clock=DEVICE[,OFFSET[,PPQN]]\n"
+           "                       also send clock to DEVICE, or \"-\" for\n"
+           "                       the output, OFFSET ms early at PPQN\n"
+           "  -D, --din[=BOUND]    model the 31250 baud of DIN MIDI on\n"
+           "                       the outputs, holding clock up by at\n"
+           "                       most BOUND us (500)\n"
+           "  -H, --headless       only print errors and reports\n"
+           "  -i, --import=SMF     print the chords of the MIDI file SMF as\n"
+           "                       a program and exit\n"
+           "  -o, --output=DEVICE  send to DEVICE, a port name, \"null\" or\n"
+           "                       \"capture:FILE\"\n"
+           "  -p, --port=DEVICE    add DEVICE as the next port sequences\n"
+           "                       and chords can route notes to\n"
+           "  -P, --preload[=MS]   send the program change of the next\n"
+           "                       sequence MS ms before it starts (250)\n"
+           "  -r, --record=FILE    record all input events to FILE\n"
+           "  -R, --render=OUT     render to the MIDI file OUT, or into the\n"
+           "                       directory OUT for several FILEs, stepping\n"
+           "                       automatically unless a SCRIPT is given\n"
+           "  -S, --slave          follow the MIDI clock of the input\n"
+           "  -s, --script=SCRIPT  replay input events from SCRIPT and\n"
+           "                       report input to output latency\n"
+           "  -T, --timecode=DEVICE[,FPS]\n"
+           "                       send MIDI time code at 24, 25 or 30\n"
+           "                       FPS to DEVICE, or \"-\" for the output\n"
+           "  -t, --trace=FILE     write a Chrome trace_event timeline\n"
+           "                       of the event loop to FILE\n"
+           "  -V, --virtual        run SCRIPT in virtual time, as fast as\n"
+           "                       possible with realtime timestamps\n",
+           name);
 }
 
 int
@@ -50,17 +272,166 @@ main (int argc, char **argv)
 {
   MMApp *app;
   MMInput *input;
+  MMOutput *output;
   MMPlayer *player;
+  MMRecorder *recorder = NULL;
 
   PmError err;
-  PmDeviceID device;
+  MMOutputDevice device;
+
+  const char *output_spec = NULL;
+  const char *script = NULL;
+  const char *record = NULL;
+  const char *trace = NULL;
+  const char *render = NULL;
+  const char *smf = NULL;
+  const char *clocks[MAX_NUM_CLOCKS];
+  const char *timecode = NULL;
+  const char *ports[MAX_NUM_PORTS];
+  int nports = 0;
+  int nclocks = 0;
+  int preload = -1;
+  bool virtual = false;
+  bool chords = false;
+  bool slave = false;
+  bool ok = true;
+  int opt;
+  const struct option options[] = {
+    {"chords", no_argument, NULL, 'c'},
+    {"clock", required_argument, NULL, 'C'},
+    {"din", optional_argument, NULL, 'D'},
+    {"headless", no_argument, NULL, 'H'},
+    {"import", required_argument, NULL, 'i'},
+    {"output", required_argument, NULL, 'o'},
+    {"port", required_argument, NULL, 'p'},
+    {"preload", optional_argument, NULL, 'P'},
+    {"record", required_argument, NULL, 'r'},
+    {"render", required_argument, NULL, 'R'},
+    {"script", required_argument, NULL, 's'},
+    {"slave", no_argument, NULL, 'S'},
+    {"timecode", required_argument, NULL, 'T'},
+    {"trace", required_argument, NULL, 't'},
+    {"virtual", no_argument, NULL, 'V'},
+    {NULL, 0, NULL, 0}
+  };
 
-  if (argc <= 1)
+  while ((opt = getopt_long (argc, argv, "cC:D::Hi:o:p:P::r:R:s:St:T:V",
+                             options, NULL)) != -1)
+    {
+      switch (opt)
+        {
+        case 'c':
+          chords = true;
+          break;
+        case 'C':
+          if (nclocks == MAX_NUM_CLOCKS)
+            {
+              MMERR ("Maximum of " MMCY ("%d") " clocks reached",
+                     MAX_NUM_CLOCKS);
+              return EXIT_FAILURE;
+            }
+          clocks[nclocks++] = optarg;
+          break;
+        case 'D':
+          _din_bound = optarg != NULL ? (unsigned int) atoi (optarg) : 500;
+          if (_din_bound == 0)
+            {
+              MMERR ("Invalid DIN bound " MMCY ("%s"), optarg);
+              return EXIT_FAILURE;
+            }
+          break;
+        case 'H':
+          mm_console_set_headless (true);
+          break;
+        case 'i':
+          smf = optarg;
+          break;
+        case 'o':
+          output_spec = optarg;
+          break;
+        case 'p':
+          if (nports == MAX_NUM_PORTS)
+            {
+              MMERR ("Maximum of " MMCY ("%d") " ports reached",
+                     MAX_NUM_PORTS);
+              return EXIT_FAILURE;
+            }
+          ports[nports++] = optarg;
+          break;
+        case 'P':
+          preload = optarg != NULL ? atoi (optarg) : 250;
+          if (preload < 0)
+            {
+              MMERR ("Invalid preload " MMCY ("%s"), optarg);
+              return EXIT_FAILURE;
+            }
+          break;
+        case 'r':
+          record = optarg;
+          break;
+        case 'R':
+          render = optarg;
+          break;
+        case 's':
+          script = optarg;
+          break;
+        case 'S':
+          slave = true;
+          break;
+        case 't':
+          trace = optarg;
+          break;
+        case 'T':
+          timecode = optarg;
+          break;
+        case 'V':
+          virtual = true;
+          break;
+        default:
+          mm_usage (argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (smf != NULL)
+    return mm_smf_import (smf, stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  if (optind >= argc)
     {
       MMERR ("No input file");
       return EXIT_FAILURE;
     }
 
+  /* Virtual time only makes sense without a performer.  */
+  if (virtual && script == NULL)
+    {
+      MMERR ("Virtual time requires a " MMCY ("--script"));
+      return EXIT_FAILURE;
+    }
+  mm_time_set_virtual (virtual);
+
+  mm_input_register_backend (mm_input_joystick_backend);
+  mm_input_register_backend (mm_input_midi_backend);
+  mm_input_register_backend (mm_input_script_backend);
+  mm_output_register_backend (mm_output_midi_backend);
+  mm_output_register_backend (mm_output_null_backend);
+  mm_output_register_backend (mm_output_capture_backend);
+  mm_output_register_backend (mm_output_smf_backend);
+
+  /* Rendering needs neither devices nor a terminal.  */
+  if (render != NULL)
+    {
+      mm_console_set_headless (true);
+      return mm_render_all (&argv[optind], argc - optind, script, render) == 0
+        ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+  mm_console_start ();
+  atexit (mm_console_stop);
+
+  if (trace != NULL)
+    mm_trace_start ();
+
   err = Pm_Initialize ();
   if (err < pmNoError)
     {
@@ -69,10 +440,17 @@ main (int argc, char **argv)
     }
 
   mm_clear_screen ();
-  mm_printf_subtitle ("Detecting input..");
-  mm_input_register_backend (mm_input_joystick_backend);
-  mm_input_register_backend (mm_input_midi_backend);
-  input = mm_input_autodetect ();
+  if (script != NULL)
+    {
+      MMInputDevice device = { mm_input_script_backend->name, 0, "" };
+      strncpy (device.name, script, sizeof (device.name) - 1);
+      input = mm_input_new (&device);
+    }
+  else
+    {
+      mm_printf_subtitle ("Detecting input..");
+      input = mm_input_autodetect ();
+    }
   if (input == NULL)
     {
       MMERR ("No input device found");
@@ -81,8 +459,8 @@ main (int argc, char **argv)
     }
   mm_clear_screen ();
 
-  device = mm_get_output_device_id (mm_input_get_name (input));
-  if (device == pmNoDevice)
+  if (!mm_get_output_device (mm_input_get_name (input), output_spec,
+                             &device))
     {
       MMERR ("No output device found");
       mm_input_free (input);
@@ -90,19 +468,51 @@ main (int argc, char **argv)
       return EXIT_FAILURE;
     }
 
-  player = mm_player_new (device);
-  if (player == NULL)
+  output = mm_output_new (&device);
+  if (output == NULL)
     {
       mm_input_free (input);
       Pm_Terminate ();
       return EXIT_FAILURE;
     }
 
+  if (_din_bound > 0)
+    mm_output_set_wire (output, DIN_BAUD, _din_bound);
+
+  player = mm_player_new (output);
+  mm_player_set_slave (player, slave);
+  mm_input_listen (input, (chords ? MMIE_BIT (MMIE_CHORD) : 0)
+                   | (slave ? MMIE_BIT (MMIE_CLOCK) | MMIE_BIT (MMIE_START)
+                      | MMIE_BIT (MMIE_STOP) : 0));
+
+  for (int i = 0; i < nports && ok; ++i)
+    ok = mm_add_port (player, mm_input_get_name (input), ports[i]);
+  for (int i = 0; i < nclocks && ok; ++i)
+    ok = mm_add_clock (player, mm_input_get_name (input), clocks[i]);
+  if (ok && timecode != NULL)
+    ok = mm_set_timecode (player, mm_input_get_name (input), timecode);
+  if (!ok)
+    {
+      mm_player_free (player);
+      mm_input_free (input);
+      Pm_Terminate ();
+      return EXIT_FAILURE;
+    }
+
+  if (record != NULL)
+    {
+      recorder = mm_recorder_new (record);
+      mm_input_set_recorder (input, recorder);
+    }
+
   app = mm_app_new (input, player);
+  mm_app_set_report (app, script != NULL);
+  mm_app_set_recognize (app, chords);
+  mm_app_set_preload (app, preload);
 
-  for (int arg = 1; arg < argc; ++arg)
+  for (int arg = optind; arg < argc; ++arg)
     {
-      MMProgram *program = mm_program_factory (argv[arg]);
+      MMProgram *program = mm_program_factory (argv[arg], nports + 1);
       if (program == NULL)
           continue;
 
@@ -114,6 +524,10 @@ main (int argc, char **argv)
     }
 
   mm_app_free (app);
+  mm_recorder_free (recorder);
+
+  if (trace != NULL)
+    mm_trace_write (trace);
 
   Pm_Terminate ();
 
@@ -0,0 +1,534 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "output.h"
+#include "trace.h"
+#include "print.h"
+
+#define MAX_NUM_BACKENDS 8
+#define MAX_WIRE_SLOTS 32
+#define NUM_CHANNELS 16
+
+/* What the device was last sent on a channel, -1 for unknown.  */
+typedef struct
+{
+  signed char program;
+  signed char controls[128];
+  bool quiet;  /* No note on since all notes were turned off.  */
+} MMChannelState;
+
+static size_t _nbackends = 0;
+static const MMOutputBackend *_backends[MAX_NUM_BACKENDS];
+
+struct _MMOutput
+{
+  MMOutputDevice device;
+  const MMOutputBackend *backend;
+  void *connection;
+  MMTimer *timer;
+  /* Wire model, see mm_output_set_wire.  Times are us on the output
+     time base.  */
+  unsigned int wire_byte;   /* us per byte, 0 for no model.  */
+  unsigned int wire_bound;  /* us a realtime message may be held up.  */
+  uint64_t wire_free;       /* The wire is idle from here.  */
+  unsigned int wire_moved;  /* Timestamp of the last message moved.  */
+  int wire_status;          /* Running status, 0 for none.  */
+  uint64_t wire_slots[MAX_WIRE_SLOTS]; /* Realtime messages to come.  */
+  size_t nslots;
+  MMChannelState channels[NUM_CHANNELS];
+};
+
+static bool write_events (MMOutput *, const MMOutputEvent *, size_t);
+static void shape_events (MMOutput *, const MMOutputEvent *, size_t,
+                          MMOutputEvent *);
+static unsigned int place (MMOutput *, unsigned int, unsigned int);
+static bool is_redundant (MMChannelState *, unsigned int);
+static void forget (MMOutput *);
+static void forget_channel (MMChannelState *);
+
+MMOutput *
+mm_output_new (const MMOutputDevice *device)
+{
+  MMOutput *output;
+  const MMOutputBackend *backend;
+  MMTimer *timer;
+  void *connection;
+
+  if (device == NULL || device->type == NULL)
+    return NULL;
+
+  backend = mm_output_get_backend (device->type);
+  if (backend == NULL)
+    {
+      MMERR ("Output backend " MMCY ("%s") " not found", device->type);
+      return NULL;
+    }
+
+  timer = mm_timer_new ();
+  connection = backend->connect (device, timer);
+  if (connection == NULL)
+    {
+      mm_timer_free (timer);
+      return NULL;
+    }
+
+  output = calloc (1, sizeof (MMOutput));
+  assert (output != NULL);
+  memcpy (&output->device, device, sizeof (MMOutputDevice));
+  output->backend = backend;
+  output->connection = connection;
+  output->timer = timer;
+  forget (output);
+
+  return output;
+}
+
+void
+mm_output_free (MMOutput *output)
+{
+  if (output != NULL)
+    {
+      output->backend->disconnect (output->connection);
+      mm_timer_free (output->timer);
+      free (output);
+    }
+}
+
+bool
+mm_output_write (MMOutput *output, const MMOutputEvent *events,
+                 size_t nevents)
+{
+  if (output == NULL || events == NULL)
+    return false;
+
+  if (nevents == 0)
+    return true;
+
+  MMOutputEvent kept[nevents];
+  MMChannelState channels[NUM_CHANNELS];
+  unsigned int touched = 0;
+  size_t nkept = 0;
+  bool written;
+
+  /* Channel state is worked out on a copy and only kept once the events
+     are written, a failed write leaving the device state unknown.  */
+  for (size_t i = 0; i < nevents; ++i)
+    {
+      int status = MM_MESSAGE_STATUS (events[i].message);
+      int c = status & 0x0F;
+
+      if (status < 0xF0 && !(touched & (1u << c)))
+        {
+          channels[c] = output->channels[c];
+          touched |= 1u << c;
+        }
+      if (status >= 0xF0 || !is_redundant (&channels[c], events[i].message))
+        kept[nkept++] = events[i];
+    }
+
+  if (nkept == 0)
+    return true;
+
+  if (output->wire_byte > 0)
+    {
+      MMOutputEvent shaped[nkept];
+      shape_events (output, kept, nkept, shaped);
+      written = write_events (output, shaped, nkept);
+    }
+  else
+    written = write_events (output, kept, nkept);
+
+  for (int c = 0; c < NUM_CHANNELS; ++c)
+    {
+      if (!(touched & (1u << c)))
+        continue;
+      if (written)
+        output->channels[c] = channels[c];
+      else
+        forget_channel (&output->channels[c]);
+    }
+
+  return written;
+}
+
+/* Returns true if the channel MESSAGE would leave a device in state
+   CHANNEL as it is, and otherwise notes in CHANNEL what it changes.
+   Some synths drop out for a moment on any program change, even to the
+   current one.  */
+static bool
+is_redundant (MMChannelState *channel, unsigned int message)
+{
+  int status = MM_MESSAGE_STATUS (message);
+  int data1 = MM_MESSAGE_DATA1 (message);
+  int data2 = MM_MESSAGE_DATA2 (message);
+
+  switch (status & 0xF0)
+    {
+    case 0x90:
+      if (data2 > 0)
+        channel->quiet = false;
+      return false;
+    case 0xC0:
+      if (channel->program == data1)
+        return true;
+      channel->program = data1;
+      return false;
+    case 0xB0:
+      break;
+    default:
+      return false;
+    }
+
+  switch (data1)
+    {
+    case 0x06: /* Data entry and increments act on the selected  */
+    case 0x26: /* parameter, which others may select in between.  */
+    case 0x60:
+    case 0x61:
+    case 0x62:
+    case 0x63:
+    case 0x64:
+    case 0x65:
+    case 0x7A: /* Local control.  */
+      return false;
+    case 0x78: /* All sound off.  */
+      channel->quiet = true;
+      return false;
+    case 0x79: /* Reset all controllers.  */
+      for (int i = 1; i < 128; ++i)
+        if (i != 0x20)
+          channel->controls[i] = -1;
+      return false;
+    case 0x7B: /* All notes off.  */
+      if (channel->quiet)
+        return true;
+      channel->quiet = true;
+      return false;
+    case 0x7C: /* Omni and mono modes, which turn notes off too.  */
+    case 0x7D:
+    case 0x7E:
+    case 0x7F:
+      channel->quiet = true;
+      return false;
+    }
+
+  if (channel->controls[data1] == data2)
+    return true;
+
+  channel->controls[data1] = data2;
+  /* A bank select takes effect on the next program change.  */
+  if (data1 == 0x00 || data1 == 0x20)
+    channel->program = -1;
+
+  return false;
+}
+
+/* Marks all device state on OUTPUT as unknown.  */
+static void
+forget (MMOutput *output)
+{
+  for (int i = 0; i < NUM_CHANNELS; ++i)
+    forget_channel (&output->channels[i]);
+}
+
+/* Marks the device state of CHANNEL as unknown.  */
+static void
+forget_channel (MMChannelState *channel)
+{
+  channel->program = -1;
+  memset (channel->controls, -1, sizeof (channel->controls));
+  channel->quiet = false;
+}
+
+/* Models a serial MIDI wire of BAUD, 10 bits a byte, behind OUTPUT.
+   Realtime messages like the clock are sent ahead of channel messages
+   written with them, and channel messages that would hold one up for
+   more than BOUND us are moved behind it.  Note offs become note ons of
+   velocity 0 so a chord goes out under one running status.  0 BAUD
+   turns the model off.  */
+void
+mm_output_set_wire (MMOutput *output, unsigned int baud, unsigned int bound)
+{
+  if (output == NULL)
+    return;
+
+  output->wire_byte = baud > 0 ? 10000000 / baud : 0;
+  output->wire_bound = bound;
+  output->wire_free = 0;
+  output->wire_moved = 0;
+  output->wire_status = 0;
+  output->nslots = 0;
+}
+
+static bool
+write_events (MMOutput *output, const MMOutputEvent *events, size_t nevents)
+{
+  bool written;
+
+  MM_TRACE_BEGIN (start);
+  written = output->backend->write (output->connection, events, nevents) >= 0;
+  MM_TRACE_END (MMTP_OUTPUT_WRITE, start, (int) nevents);
+
+  return written;
+}
+
+void
+mm_output_set_tempo (MMOutput *output, double bpm)
+{
+  if (output != NULL && bpm > 0. && output->backend->set_tempo != NULL)
+    output->backend->set_tempo (output->connection, bpm);
+}
+
+/* Writes the complete system exclusive message DATA, F0 to F7, at
+   TIMESTAMP.  Backends without sysex drop it.  */
+bool
+mm_output_write_sysex (MMOutput *output, const unsigned char *data,
+                       size_t length, unsigned int timestamp)
+{
+  bool written;
+
+  if (output == NULL || data == NULL || length < 2)
+    return false;
+
+  if (output->backend->write_sysex == NULL)
+    return false;
+
+  /* Apart from universal realtime messages, a system exclusive message
+     may change anything on the device.  */
+  if (data[1] != 0x7F)
+    forget (output);
+
+  if (output->wire_byte > 0)
+    {
+      output->wire_status = 0;
+      timestamp = place (output, timestamp, length * output->wire_byte);
+    }
+
+  MM_TRACE_BEGIN (start);
+  written = output->backend->write_sysex (output->connection, data, length,
+                                          timestamp) >= 0;
+  MM_TRACE_END (MMTP_OUTPUT_WRITE, start, 1);
+
+  return written;
+}
+
+unsigned int
+mm_output_get_time (const MMOutput *output)
+{
+  return (output != NULL) ? mm_timer_get_age (output->timer) : 0;
+}
+
+static void
+prune_slots (MMOutput *output, uint64_t now)
+{
+  size_t n = 0;
+
+  while (n < output->nslots
+         && output->wire_slots[n] + output->wire_byte <= now)
+    ++n;
+  output->nslots -= n;
+  memmove (output->wire_slots, &output->wire_slots[n],
+           output->nslots * sizeof (uint64_t));
+}
+
+static void
+reserve_slot (MMOutput *output, uint64_t time)
+{
+  size_t pos = output->nslots;
+
+  /* Beyond this many, realtime messages simply aren't made room for.  */
+  if (output->nslots == MAX_WIRE_SLOTS)
+    return;
+
+  while (pos > 0 && output->wire_slots[pos - 1] > time)
+    --pos;
+  memmove (&output->wire_slots[pos + 1], &output->wire_slots[pos],
+           (output->nslots - pos) * sizeof (uint64_t));
+  output->wire_slots[pos] = time;
+  ++output->nslots;
+}
+
+/* Puts COST us of bytes on the wire from TIMESTAMP ms, or later if that
+   holds up a realtime message for more than the bound.  Drivers send in
+   timestamp order, so a realtime message waits for everything stamped
+   before it.  Returns the timestamp to send the bytes at.  Timestamps
+   are whole ms, so moved bytes go out on the first ms after the realtime
+   message, and so does everything written after them.  */
+static unsigned int
+place (MMOutput *output, unsigned int timestamp, unsigned int cost)
+{
+  uint64_t time, start;
+
+  if (timestamp < output->wire_moved)
+    timestamp = output->wire_moved;
+  time = (uint64_t) timestamp * 1000;
+  start = time > output->wire_free ? time : output->wire_free;
+
+  for (size_t i = 0; i < output->nslots; ++i)
+    {
+      uint64_t slot = output->wire_slots[i];
+
+      if (time > slot || start + cost <= slot + output->wire_bound)
+        continue;
+
+      timestamp = (unsigned int) ((slot + output->wire_byte + 999) / 1000);
+      time = (uint64_t) timestamp * 1000;
+      start = time > output->wire_free ? time : output->wire_free;
+      if (start < slot + output->wire_byte)
+        start = slot + output->wire_byte;
+      output->wire_moved = timestamp;
+    }
+
+  output->wire_free = start + cost;
+
+  return timestamp;
+}
+
+/* Copies EVENTS to SHAPED in the order and at the times the wire model
+   sends them: realtime and system messages first, as written, then
+   channel messages, spread around the realtime ones.  */
+static void
+shape_events (MMOutput *output, const MMOutputEvent *events, size_t nevents,
+              MMOutputEvent *shaped)
+{
+  uint64_t now = (uint64_t) mm_output_get_time (output) * 1000;
+  size_t n = 0;
+
+  prune_slots (output, now);
+  if (output->wire_free < now)
+    output->wire_free = now;
+
+  for (size_t i = 0; i < nevents; ++i)
+    {
+      int status = MM_MESSAGE_STATUS (events[i].message);
+
+      if (status < 0xF0)
+        continue;
+
+      shaped[n] = events[i];
+      if (status >= 0xF8)
+        reserve_slot (output, (uint64_t) events[i].timestamp * 1000);
+      else
+        {
+          output->wire_status = 0;
+          shaped[n].timestamp = place (output, events[i].timestamp,
+                                       mm_message_length (status)
+                                       * output->wire_byte);
+        }
+      ++n;
+    }
+
+  for (size_t i = 0; i < nevents; ++i)
+    {
+      int status = MM_MESSAGE_STATUS (events[i].message);
+      int data1 = MM_MESSAGE_DATA1 (events[i].message);
+      int data2 = MM_MESSAGE_DATA2 (events[i].message);
+      int length = mm_message_length (status);
+
+      if (status >= 0xF0)
+        continue;
+
+      if ((status & 0xF0) == 0x80 && data2 == 0x40)
+        {
+          status = 0x90 | (status & 0x0F);
+          data2 = 0x00;
+        }
+      if (status == output->wire_status)
+        --length;
+      output->wire_status = status;
+
+      shaped[n].message = MM_MESSAGE (status, data1, data2);
+      shaped[n].timestamp = place (output, events[i].timestamp,
+                                   length * output->wire_byte);
+      ++n;
+    }
+}
+
+const char *
+mm_output_get_name (const MMOutput *output)
+{
+  return (output != NULL) ? output->device.name : NULL;
+}
+
+bool
+mm_output_register_backend (const MMOutputBackend *backend)
+{
+  if (backend == NULL || backend->name == NULL || backend->connect == NULL
+      || backend->disconnect == NULL || backend->write == NULL
+      || backend->probe == NULL)
+    {
+      MMERR ("Invalid output backend");
+      return false;
+    }
+
+  for (unsigned i = 0; i < _nbackends; ++i)
+    {
+      if (_backends[i] == backend
+          || strcmp (_backends[i]->name, backend->name) == 0)
+        {
+          MMERR ("Output backend " MMCY ("%s") " already registered",
+                 backend->name);
+          return false;
+        }
+    }
+
+  if (_nbackends == MAX_NUM_BACKENDS)
+    {
+      MMERR ("Maximum of " MMCY ("%d") " output backends reached",
+             MAX_NUM_BACKENDS);
+      return false;
+    }
+
+  _backends[_nbackends++] = backend;
+
+  return true;
+}
+
+const MMOutputBackend *
+mm_output_get_backend (const char *name)
+{
+  if (name == NULL)
+    return NULL;
+
+  for (unsigned i = 0; i < _nbackends; ++i)
+    {
+      if (strcasecmp (_backends[i]->name, name) == 0)
+        return _backends[i];
+    }
+
+  return NULL;
+}
+
+size_t
+mm_output_list_devices (MMOutputDevice *devices, size_t ndevices)
+{
+  size_t found = 0;
+
+  if (devices == NULL || ndevices == 0)
+    return 0;
+
+  for (unsigned i = 0; i < _nbackends && found < ndevices; ++i)
+    found += _backends[i]->probe (&devices[found], ndevices - found);
+
+  return found;
+}
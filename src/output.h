@@ -0,0 +1,98 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef MM_OUTPUT_H
+#define MM_OUTPUT_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "timer.h"
+
+#define MM_MESSAGE(status, data1, data2) \
+  ((((data2) & 0xFF) << 16) | (((data1) & 0xFF) << 8) | ((status) & 0xFF))
+#define MM_MESSAGE_STATUS(msg) ((msg) & 0xFF)
+#define MM_MESSAGE_DATA1(msg) (((msg) >> 8) & 0xFF)
+#define MM_MESSAGE_DATA2(msg) (((msg) >> 16) & 0xFF)
+
+typedef struct _MMOutput MMOutput;
+
+static inline int
+mm_message_length (int status)
+{
+  switch (status & 0xF0)
+    {
+    case 0xC0:
+    case 0xD0:
+      return 2;
+    case 0xF0:
+      switch (status)
+        {
+        case 0xF1:
+        case 0xF3:
+          return 2;
+        case 0xF2:
+          return 3;
+        default:
+          return 1;
+        }
+    default:
+      return 3;
+    }
+}
+
+/* TIMESTAMP is in ms on the time base of the output, see
+   mm_output_get_time.  */
+typedef struct
+{
+  unsigned int message;
+  unsigned int timestamp;
+} MMOutputEvent;
+
+typedef struct
+{
+  const char *type;
+  int id;
+  char name[128];
+} MMOutputDevice;
+
+typedef struct
+{
+  const char *name;
+  void * (*connect) (const MMOutputDevice *, const MMTimer *);
+  void (*disconnect) (void *);
+  int (*write) (void *, const MMOutputEvent *, size_t);
+  size_t (*probe) (MMOutputDevice *, size_t);
+  /* Optional.  */
+  void (*set_tempo) (void *, double);
+  int (*write_sysex) (void *, const unsigned char *, size_t, unsigned int);
+} MMOutputBackend;
+
+MMOutput *mm_output_new (const MMOutputDevice *);
+void mm_output_free (MMOutput *);
+bool mm_output_write (MMOutput *, const MMOutputEvent *, size_t);
+void mm_output_set_tempo (MMOutput *, double);
+void mm_output_set_wire (MMOutput *, unsigned int, unsigned int);
+bool mm_output_write_sysex (MMOutput *, const unsigned char *, size_t,
+                            unsigned int);
+unsigned int mm_output_get_time (const MMOutput *);
+const char *mm_output_get_name (const MMOutput *);
+bool mm_output_register_backend (const MMOutputBackend *);
+const MMOutputBackend *mm_output_get_backend (const char *);
+size_t mm_output_list_devices (MMOutputDevice *, size_t);
+
+#endif /* ! MM_OUTPUT_H */
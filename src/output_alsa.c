@@ -0,0 +1,254 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <alsa/asoundlib.h>
+
+#include "output_alsa.h"
+#include "print.h"
+
+/* Sends through a virtual ALSA sequencer port and leaves the timing to a
+   kernel queue: every message is scheduled in real time on the queue, so
+   notes and clock pulses go out when they are due even if MemfisMIDI is
+   not running at that moment.  A device name of the form "CLIENT:PORT"
+   also subscribes that port, otherwise others connect to us.  Not built
+   or registered until it has been run against a real sequencer.  */
+
+#define CLIENT_NAME "MemfisMIDI"
+#define QUEUE_PPQ 24
+
+typedef struct
+{
+  snd_seq_t *seq;
+  snd_midi_event_t *encoder;
+  int port;
+  int queue;
+  const MMTimer *timer;
+  unsigned int offset;
+} MMOutputAlsa;
+
+static void *
+mm_output_alsa_connect (const MMOutputDevice *device, const MMTimer *timer)
+{
+  MMOutputAlsa *output;
+  snd_seq_queue_tempo_t *tempo;
+  snd_seq_addr_t dest;
+  int err;
+
+  if (device == NULL)
+    return NULL;
+
+  output = calloc (1, sizeof (MMOutputAlsa));
+  assert (output != NULL);
+  output->timer = timer;
+  output->port = -1;
+  output->queue = -1;
+
+  err = snd_seq_open (&output->seq, "default", SND_SEQ_OPEN_OUTPUT, 0);
+  if (err < 0)
+    {
+      MMERR ("Could not open ALSA sequencer: " MMCY ("%s"),
+             snd_strerror (err));
+      free (output);
+      return NULL;
+    }
+
+  snd_seq_set_client_name (output->seq, CLIENT_NAME);
+
+  output->port = snd_seq_create_simple_port (output->seq, CLIENT_NAME,
+                                             SND_SEQ_PORT_CAP_READ
+                                             | SND_SEQ_PORT_CAP_SUBS_READ,
+                                             SND_SEQ_PORT_TYPE_MIDI_GENERIC
+                                             | SND_SEQ_PORT_TYPE_APPLICATION);
+  output->queue = snd_seq_alloc_named_queue (output->seq, CLIENT_NAME);
+  if (output->port < 0 || output->queue < 0
+      || snd_midi_event_new (16, &output->encoder) < 0)
+    {
+      MMERR ("Could not set up ALSA port and queue");
+      if (output->queue >= 0)
+        snd_seq_free_queue (output->seq, output->queue);
+      snd_seq_close (output->seq);
+      free (output);
+      return NULL;
+    }
+
+  snd_seq_queue_tempo_alloca (&tempo);
+  snd_seq_queue_tempo_set_tempo (tempo, 500000); /* 120 bpm.  */
+  snd_seq_queue_tempo_set_ppq (tempo, QUEUE_PPQ);
+  snd_seq_set_queue_tempo (output->seq, output->queue, tempo);
+
+  if (device->name[0] != '\0'
+      && snd_seq_parse_address (output->seq, &dest, device->name) == 0)
+    {
+      err = snd_seq_connect_to (output->seq, output->port,
+                                dest.client, dest.port);
+      if (err < 0)
+        MMERR ("Could not connect to " MMCY ("%s") ": " MMCY ("%s"),
+               device->name, snd_strerror (err));
+    }
+
+  /* Queue time zero is this instant on the output time base.  */
+  snd_seq_start_queue (output->seq, output->queue, NULL);
+  snd_seq_drain_output (output->seq);
+  output->offset = mm_timer_get_age (timer);
+
+  return output;
+}
+
+static void
+mm_output_alsa_disconnect (void *connection)
+{
+  MMOutputAlsa *output = (MMOutputAlsa *) connection;
+  if (output == NULL)
+    return;
+
+  snd_seq_stop_queue (output->seq, output->queue, NULL);
+  snd_seq_drain_output (output->seq);
+  snd_seq_free_queue (output->seq, output->queue);
+  snd_midi_event_free (output->encoder);
+  snd_seq_close (output->seq);
+  free (output);
+}
+
+static int
+mm_output_alsa_write (void *connection, const MMOutputEvent *events,
+                      size_t nevents)
+{
+  MMOutputAlsa *output = (MMOutputAlsa *) connection;
+  unsigned int now;
+
+  if (output == NULL || events == NULL)
+    return -1;
+
+  now = mm_timer_get_age (output->timer);
+
+  for (size_t i = 0; i < nevents; ++i)
+    {
+      snd_seq_event_t ev;
+      snd_seq_real_time_t time;
+      unsigned char bytes[3];
+      unsigned int ms = events[i].timestamp;
+      int status = MM_MESSAGE_STATUS (events[i].message);
+
+      bytes[0] = status;
+      bytes[1] = MM_MESSAGE_DATA1 (events[i].message);
+      bytes[2] = MM_MESSAGE_DATA2 (events[i].message);
+
+      snd_seq_ev_clear (&ev);
+      snd_midi_event_reset_encode (output->encoder);
+      if (snd_midi_event_encode (output->encoder, bytes,
+                                 mm_message_length (status), &ev) <= 0
+          || ev.type == SND_SEQ_EVENT_NONE)
+        {
+          MMERR ("Could not encode message " MMCY ("0x%X"),
+                 events[i].message);
+          continue;
+        }
+
+      /* Late events go out right away.  */
+      if (ms < now)
+        ms = now;
+      ms = (ms > output->offset) ? ms - output->offset : 0;
+      time.tv_sec = ms / 1000;
+      time.tv_nsec = (ms % 1000) * 1000000;
+
+      snd_seq_ev_set_source (&ev, output->port);
+      snd_seq_ev_set_subs (&ev);
+      snd_seq_ev_schedule_real (&ev, output->queue, 0, &time);
+      snd_seq_event_output (output->seq, &ev);
+    }
+
+  if (snd_seq_drain_output (output->seq) < 0)
+    {
+      MMERR ("Could not drain ALSA output");
+      return -1;
+    }
+
+  return (int) nevents;
+}
+
+static int
+mm_output_alsa_write_sysex (void *connection, const unsigned char *data,
+                            size_t length, unsigned int timestamp)
+{
+  MMOutputAlsa *output = (MMOutputAlsa *) connection;
+  snd_seq_event_t ev;
+  snd_seq_real_time_t time;
+  unsigned int now, ms = timestamp;
+
+  if (output == NULL || data == NULL)
+    return -1;
+
+  now = mm_timer_get_age (output->timer);
+  if (ms < now)
+    ms = now;
+  ms = (ms > output->offset) ? ms - output->offset : 0;
+  time.tv_sec = ms / 1000;
+  time.tv_nsec = (ms % 1000) * 1000000;
+
+  snd_seq_ev_clear (&ev);
+  snd_seq_ev_set_sysex (&ev, length, (void *) data);
+  snd_seq_ev_set_source (&ev, output->port);
+  snd_seq_ev_set_subs (&ev);
+  snd_seq_ev_schedule_real (&ev, output->queue, 0, &time);
+  if (snd_seq_event_output (output->seq, &ev) < 0
+      || snd_seq_drain_output (output->seq) < 0)
+    {
+      MMERR ("Could not write " MMCY ("%zu") " sysex bytes", length);
+      return -1;
+    }
+
+  return (int) length;
+}
+
+static size_t
+mm_output_alsa_probe (MMOutputDevice *devices, size_t ndevices)
+{
+  /* Picked explicitly, never autodetected.  */
+  (void) devices;
+  (void) ndevices;
+  return 0;
+}
+
+static void
+mm_output_alsa_set_tempo (void *connection, double bpm)
+{
+  MMOutputAlsa *output = (MMOutputAlsa *) connection;
+
+  if (output == NULL || bpm <= 0.)
+    return;
+
+  /* Keeps the queue's tick position on our beat grid.  */
+  snd_seq_change_queue_tempo (output->seq, output->queue,
+                              (int) (60000000. / bpm), NULL);
+  snd_seq_drain_output (output->seq);
+}
+
+static const MMOutputBackend _mm_output_alsa_backend = {
+  "ALSA",
+  mm_output_alsa_connect,
+  mm_output_alsa_disconnect,
+  mm_output_alsa_write,
+  mm_output_alsa_probe,
+  mm_output_alsa_set_tempo,
+  mm_output_alsa_write_sysex
+};
+
+const MMOutputBackend *mm_output_alsa_backend = &_mm_output_alsa_backend;
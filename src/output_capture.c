@@ -0,0 +1,124 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "output_capture.h"
+#include "print.h"
+
+/* Writes every message to the file named by the device as a line of
+   "<timestamp ms> <status> <data1> <data2>", so runs can be diffed.
+   System exclusive messages list all their bytes.  */
+
+typedef struct
+{
+  FILE *file;
+} MMOutputCapture;
+
+static void *
+mm_output_capture_connect (const MMOutputDevice *device, const MMTimer *timer)
+{
+  MMOutputCapture *output;
+  FILE *file;
+
+  (void) timer;
+
+  if (device == NULL)
+    return NULL;
+
+  file = fopen (device->name, "w");
+  if (file == NULL)
+    {
+      MMERR ("Failed to open " MMCY ("%s"), device->name);
+      return NULL;
+    }
+
+  output = calloc (1, sizeof (MMOutputCapture));
+  assert (output != NULL);
+  output->file = file;
+
+  return output;
+}
+
+static void
+mm_output_capture_disconnect (void *connection)
+{
+  MMOutputCapture *output = (MMOutputCapture *) connection;
+  if (output == NULL)
+    return;
+
+  fclose (output->file);
+  free (output);
+}
+
+static int
+mm_output_capture_write (void *connection, const MMOutputEvent *events,
+                         size_t nevents)
+{
+  MMOutputCapture *output = (MMOutputCapture *) connection;
+
+  if (output == NULL || events == NULL)
+    return -1;
+
+  for (size_t i = 0; i < nevents; ++i)
+    fprintf (output->file, "%u %.2X %.2X %.2X\n", events[i].timestamp,
+             MM_MESSAGE_STATUS (events[i].message),
+             MM_MESSAGE_DATA1 (events[i].message),
+             MM_MESSAGE_DATA2 (events[i].message));
+
+  return (int) nevents;
+}
+
+static int
+mm_output_capture_write_sysex (void *connection, const unsigned char *data,
+                               size_t length, unsigned int timestamp)
+{
+  MMOutputCapture *output = (MMOutputCapture *) connection;
+
+  if (output == NULL || data == NULL)
+    return -1;
+
+  fprintf (output->file, "%u", timestamp);
+  for (size_t i = 0; i < length; ++i)
+    fprintf (output->file, " %.2X", data[i]);
+  fputc ('\n', output->file);
+
+  return (int) length;
+}
+
+static size_t
+mm_output_capture_probe (MMOutputDevice *devices, size_t ndevices)
+{
+  /* Picked explicitly, never autodetected.  */
+  (void) devices;
+  (void) ndevices;
+  return 0;
+}
+
+static const MMOutputBackend _mm_output_capture_backend = {
+  "CAPTURE",
+  mm_output_capture_connect,
+  mm_output_capture_disconnect,
+  mm_output_capture_write,
+  mm_output_capture_probe,
+  NULL,
+  mm_output_capture_write_sysex
+};
+
+const MMOutputBackend *mm_output_capture_backend = &_mm_output_capture_backend;
@@ -0,0 +1,174 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <portmidi.h>
+
+#include "output_midi.h"
+#include "print.h"
+
+#define MAX_BATCH_SIZE 32
+
+typedef struct {
+  PortMidiStream *stream;
+} MMOutputMidi;
+
+static PmTimestamp
+mm_output_midi_time_proc (void *time_info)
+{
+  /* Signed 32bit int overflows in about 25 days.  */
+  return (PmTimestamp) mm_timer_get_age ((const MMTimer *) time_info);
+}
+
+static void *
+mm_output_midi_connect (const MMOutputDevice *device, const MMTimer *timer)
+{
+  MMOutputMidi *output;
+  PmError err;
+  PortMidiStream *stream = NULL;
+
+  if (device == NULL)
+    return NULL;
+
+  /* Latency 1 makes PortMidi honor the timestamps.  */
+  err = Pm_OpenOutput (&stream, device->id, NULL, MAX_BATCH_SIZE,
+                       mm_output_midi_time_proc, (void *) timer, 1);
+  if (err < pmNoError || stream == NULL)
+    {
+      MMERR ("MIDI Device " MMCY ("%d") " could not be opened: " MMCY ("%s"),
+             device->id, Pm_GetErrorText (err));
+      return NULL;
+    }
+
+  output = calloc (1, sizeof (MMOutputMidi));
+  assert (output != NULL);
+  output->stream = stream;
+
+  return output;
+}
+
+static void
+mm_output_midi_disconnect (void *connection)
+{
+  MMOutputMidi *output = (MMOutputMidi *) connection;
+  if (output == NULL)
+    return;
+
+  if (output->stream != NULL)
+    Pm_Close (output->stream);
+
+  free (output);
+}
+
+static int
+mm_output_midi_write (void *connection, const MMOutputEvent *events,
+                      size_t nevents)
+{
+  MMOutputMidi *output = (MMOutputMidi *) connection;
+  PmEvent buffer[MAX_BATCH_SIZE];
+  PmError err;
+
+  if (output == NULL || output->stream == NULL || events == NULL)
+    return -1;
+
+  for (size_t done = 0; done < nevents;)
+    {
+      size_t n = nevents - done;
+      if (n > MAX_BATCH_SIZE)
+        n = MAX_BATCH_SIZE;
+
+      for (size_t i = 0; i < n; ++i)
+        {
+          buffer[i].message = (PmMessage) events[done + i].message;
+          buffer[i].timestamp = (PmTimestamp) events[done + i].timestamp;
+        }
+
+      err = Pm_Write (output->stream, buffer, (int32_t) n);
+      if (err < pmNoError)
+        {
+          MMERR ("Writing " MMCY ("%zu") " messages returned " MMCY ("%s"),
+                 n, Pm_GetErrorText (err));
+          return -1;
+        }
+
+      done += n;
+    }
+
+  return (int) nevents;
+}
+
+static int
+mm_output_midi_write_sysex (void *connection, const unsigned char *data,
+                            size_t length, unsigned int timestamp)
+{
+  MMOutputMidi *output = (MMOutputMidi *) connection;
+  PmError err;
+
+  if (output == NULL || output->stream == NULL || data == NULL)
+    return -1;
+
+  /* PortMidi reads up to the terminating F7.  */
+  err = Pm_WriteSysEx (output->stream, (PmTimestamp) timestamp,
+                       (unsigned char *) data);
+  if (err < pmNoError)
+    {
+      MMERR ("Writing " MMCY ("%zu") " sysex bytes returned " MMCY ("%s"),
+             length, Pm_GetErrorText (err));
+      return -1;
+    }
+
+  return (int) length;
+}
+
+static size_t
+mm_output_midi_probe (MMOutputDevice *devices, size_t ndevices)
+{
+  size_t found = 0;
+
+  if (devices == NULL || ndevices == 0)
+    return 0;
+
+  for (int id = 0; id < Pm_CountDevices () && found < ndevices; ++id)
+    {
+      const PmDeviceInfo *pmdev = Pm_GetDeviceInfo (id);
+      if (pmdev != NULL && pmdev->output == 1)
+        {
+          MMOutputDevice *device = &devices[found++];
+          device->type = mm_output_midi_backend->name;
+          device->id = id;
+          strncpy (device->name, pmdev->name, sizeof (device->name) - 1);
+          device->name[sizeof (device->name) - 1] = '\0';
+        }
+    }
+
+  return found;
+}
+
+static const MMOutputBackend _mm_output_midi_backend = {
+  "MIDI",
+  mm_output_midi_connect,
+  mm_output_midi_disconnect,
+  mm_output_midi_write,
+  mm_output_midi_probe,
+  NULL,
+  mm_output_midi_write_sysex
+};
+
+const MMOutputBackend *mm_output_midi_backend = &_mm_output_midi_backend;
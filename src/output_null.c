@@ -0,0 +1,78 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+
+#include "output_null.h"
+
+/* Discards everything, for running the player without any MIDI device.  */
+
+static int _mm_output_null_connection;
+
+static void *
+mm_output_null_connect (const MMOutputDevice *device, const MMTimer *timer)
+{
+  (void) device;
+  (void) timer;
+  return &_mm_output_null_connection;
+}
+
+static void
+mm_output_null_disconnect (void *connection)
+{
+  (void) connection;
+}
+
+static int
+mm_output_null_write (void *connection, const MMOutputEvent *events,
+                      size_t nevents)
+{
+  (void) connection;
+  (void) events;
+  return (int) nevents;
+}
+
+static int
+mm_output_null_write_sysex (void *connection, const unsigned char *data,
+                            size_t length, unsigned int timestamp)
+{
+  (void) connection;
+  (void) data;
+  (void) timestamp;
+  return (int) length;
+}
+
+static size_t
+mm_output_null_probe (MMOutputDevice *devices, size_t ndevices)
+{
+  /* Picked explicitly, never autodetected.  */
+  (void) devices;
+  (void) ndevices;
+  return 0;
+}
+
+static const MMOutputBackend _mm_output_null_backend = {
+  "NULL",
+  mm_output_null_connect,
+  mm_output_null_disconnect,
+  mm_output_null_write,
+  mm_output_null_probe,
+  NULL,
+  mm_output_null_write_sysex
+};
+
+const MMOutputBackend *mm_output_null_backend = &_mm_output_null_backend;
@@ -0,0 +1,307 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "output_smf.h"
+#include "print.h"
+
+/* Collects every message and writes them to the file named by the device
+   as a format 0 Standard MIDI File once disconnected.  The file runs at
+   60 BPM with PPQ ticks per quarter, so one tick is exactly one ms of the
+   output time base.  Real-time messages like the clock are stored as F7
+   escapes.  */
+#define PPQ 1000
+#define USEC_PER_QUARTER 1000000
+
+/* System exclusive messages are kept apart in SYSEX, each as a 16 bit
+   length and its bytes, and sorted in as events with status F0 and the
+   offset of the message in place of the data bytes.  */
+typedef struct
+{
+  char *path;
+  MMOutputEvent *events;
+  size_t nevents;
+  size_t size;
+  unsigned char *sysex;
+  size_t sysex_length;
+  size_t sysex_size;
+} MMOutputSMF;
+
+typedef struct
+{
+  unsigned char *data;
+  size_t length;
+  size_t size;
+} MMBuffer;
+
+static void
+put_byte (MMBuffer *buffer, unsigned char byte)
+{
+  if (buffer->length == buffer->size)
+    {
+      buffer->size = buffer->size > 0 ? buffer->size * 2 : 4096;
+      buffer->data = realloc (buffer->data, buffer->size);
+      assert (buffer->data != NULL);
+    }
+  buffer->data[buffer->length++] = byte;
+}
+
+static void
+put_be (MMBuffer *buffer, uint32_t value, int nbytes)
+{
+  for (int i = nbytes - 1; i >= 0; --i)
+    put_byte (buffer, (unsigned char) (value >> (8 * i)));
+}
+
+static void
+put_vlq (MMBuffer *buffer, uint32_t value)
+{
+  unsigned char bytes[5];
+  int n = 0;
+
+  do
+    {
+      bytes[n++] = value & 0x7F;
+      value >>= 7;
+    }
+  while (value > 0);
+
+  while (n-- > 0)
+    put_byte (buffer, bytes[n] | (n > 0 ? 0x80 : 0x00));
+}
+
+static bool
+write_file (const MMOutputSMF *output)
+{
+  MMBuffer track = { NULL, 0, 0 };
+  unsigned int time = 0;
+  int running = 0;
+  FILE *file;
+  bool written;
+
+  /* Tempo.  */
+  put_vlq (&track, 0);
+  put_byte (&track, 0xFF);
+  put_byte (&track, 0x51);
+  put_byte (&track, 0x03);
+  put_be (&track, USEC_PER_QUARTER, 3);
+
+  for (size_t i = 0; i < output->nevents; ++i)
+    {
+      const MMOutputEvent *event = &output->events[i];
+      int status = MM_MESSAGE_STATUS (event->message);
+      int length = mm_message_length (status);
+
+      put_vlq (&track, event->timestamp - time);
+      time = event->timestamp;
+
+      if (status == 0xF0)
+        {
+          const unsigned char *data = &output->sysex[event->message >> 8];
+          size_t size = (data[0] << 8) | data[1];
+
+          put_byte (&track, 0xF0);
+          put_vlq (&track, size - 1);
+          for (size_t j = 1; j < size; ++j)
+            put_byte (&track, data[2 + j]);
+          running = 0;
+          continue;
+        }
+      else if (status >= 0xF0)
+        {
+          put_byte (&track, 0xF7);
+          put_vlq (&track, length);
+          running = 0;
+        }
+      else if (status == running)
+        {
+          put_byte (&track, MM_MESSAGE_DATA1 (event->message));
+          if (length > 2)
+            put_byte (&track, MM_MESSAGE_DATA2 (event->message));
+          continue;
+        }
+      else
+        running = status;
+
+      put_byte (&track, status);
+      if (length > 1)
+        put_byte (&track, MM_MESSAGE_DATA1 (event->message));
+      if (length > 2)
+        put_byte (&track, MM_MESSAGE_DATA2 (event->message));
+    }
+
+  /* End of track.  */
+  put_vlq (&track, 0);
+  put_byte (&track, 0xFF);
+  put_byte (&track, 0x2F);
+  put_byte (&track, 0x00);
+
+  file = fopen (output->path, "wb");
+  if (file == NULL)
+    {
+      MMERR ("Failed to open " MMCY ("%s"), output->path);
+      free (track.data);
+      return false;
+    }
+
+  written = fwrite ("MThd\0\0\0\6\0\0\0\1", 1, 12, file) == 12
+    && fputc (PPQ >> 8, file) != EOF
+    && fputc (PPQ & 0xFF, file) != EOF
+    && fwrite ("MTrk", 1, 4, file) == 4
+    && fputc ((track.length >> 24) & 0xFF, file) != EOF
+    && fputc ((track.length >> 16) & 0xFF, file) != EOF
+    && fputc ((track.length >> 8) & 0xFF, file) != EOF
+    && fputc (track.length & 0xFF, file) != EOF
+    && fwrite (track.data, 1, track.length, file) == track.length;
+
+  if (fclose (file) != 0 || !written)
+    {
+      MMERR ("Failed to write " MMCY ("%s"), output->path);
+      written = false;
+    }
+
+  free (track.data);
+  return written;
+}
+
+static void *
+mm_output_smf_connect (const MMOutputDevice *device, const MMTimer *timer)
+{
+  MMOutputSMF *output;
+
+  (void) timer;
+
+  if (device == NULL || device->name[0] == '\0')
+    return NULL;
+
+  output = calloc (1, sizeof (MMOutputSMF));
+  assert (output != NULL);
+  output->path = strdup (device->name);
+  assert (output->path != NULL);
+
+  return output;
+}
+
+static void
+mm_output_smf_disconnect (void *connection)
+{
+  MMOutputSMF *output = (MMOutputSMF *) connection;
+  if (output == NULL)
+    return;
+
+  write_file (output);
+
+  free (output->events);
+  free (output->sysex);
+  free (output->path);
+  free (output);
+}
+
+static void
+insert_event (MMOutputSMF *output, const MMOutputEvent *event)
+{
+  size_t pos = output->nevents;
+
+  if (output->nevents == output->size)
+    {
+      output->size = output->size > 0 ? output->size * 2 : 1024;
+      output->events = realloc (output->events,
+                                output->size * sizeof (MMOutputEvent));
+      assert (output->events != NULL);
+    }
+
+  /* Events arrive almost in order, clock pulses are at most a pulse
+     ahead, so insertion from the back keeps them sorted cheaply.
+     Simultaneous events keep the order they were written in.  */
+  while (pos > 0 && output->events[pos - 1].timestamp > event->timestamp)
+    --pos;
+  memmove (&output->events[pos + 1], &output->events[pos],
+           (output->nevents - pos) * sizeof (MMOutputEvent));
+  output->events[pos] = *event;
+  ++output->nevents;
+}
+
+static int
+mm_output_smf_write (void *connection, const MMOutputEvent *events,
+                     size_t nevents)
+{
+  MMOutputSMF *output = (MMOutputSMF *) connection;
+
+  if (output == NULL || events == NULL)
+    return -1;
+
+  for (size_t i = 0; i < nevents; ++i)
+    insert_event (output, &events[i]);
+
+  return (int) nevents;
+}
+
+static int
+mm_output_smf_write_sysex (void *connection, const unsigned char *data,
+                           size_t length, unsigned int timestamp)
+{
+  MMOutputSMF *output = (MMOutputSMF *) connection;
+  MMOutputEvent event;
+
+  if (output == NULL || data == NULL || length > 0xFFFF
+      || output->sysex_length + length + 2 > 0xFFFFFF)
+    return -1;
+
+  while (output->sysex_length + length + 2 > output->sysex_size)
+    {
+      output->sysex_size = output->sysex_size > 0
+        ? output->sysex_size * 2 : 1024;
+      output->sysex = realloc (output->sysex, output->sysex_size);
+      assert (output->sysex != NULL);
+    }
+
+  event.message = 0xF0 | (unsigned int) (output->sysex_length << 8);
+  event.timestamp = timestamp;
+  output->sysex[output->sysex_length++] = (length >> 8) & 0xFF;
+  output->sysex[output->sysex_length++] = length & 0xFF;
+  memcpy (&output->sysex[output->sysex_length], data, length);
+  output->sysex_length += length;
+  insert_event (output, &event);
+
+  return (int) length;
+}
+
+static size_t
+mm_output_smf_probe (MMOutputDevice *devices, size_t ndevices)
+{
+  /* Picked explicitly, never autodetected.  */
+  (void) devices;
+  (void) ndevices;
+  return 0;
+}
+
+static const MMOutputBackend _mm_output_smf_backend = {
+  "SMF",
+  mm_output_smf_connect,
+  mm_output_smf_disconnect,
+  mm_output_smf_write,
+  mm_output_smf_probe,
+  NULL,
+  mm_output_smf_write_sysex
+};
+
+const MMOutputBackend *mm_output_smf_backend = &_mm_output_smf_backend;
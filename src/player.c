@@ -21,57 +21,141 @@
 
 #include "player.h"
 #include "timer.h"
+#include "trace.h"
 #include "print.h"
 
+/* Room for a full lift: 12 notes off, 12 on and a spare.  */
+#define MAX_BATCH_SIZE 32
+
+/* Gains of the alpha-beta filter following an external clock, critically
+   damped: phase settles within about 20 pulses and the period a little
+   slower.  Errors beyond a period are gaps, not jitter, and relock.  */
+#define PLL_ALPHA 0.1
+#define PLL_BETA (PLL_ALPHA * PLL_ALPHA / (2. - PLL_ALPHA))
+#define PLL_MIN_BPM 20.
+#define PLL_MAX_BPM 300.
+
+#define MAX_NOTE_PORTS 8
+#define MAX_CLOCK_PORTS 8
+#define MAX_CLOCK_MUL 8 /* 192 ppqn.  */
+
+/* Quarter frames are sent as far ahead as clock pulses, so no more than
+   a pulse period of them at once.  */
+#define MAX_MTC_BATCH 32
+
+/* Notes playing are kept as keys holding their port and channel, so
+   chords on several routes diff like plain notes.  */
+#define NOTE_KEY(port, channel, note) \
+  (((int) (port) << 11) | ((channel) << 7) | (note))
+#define KEY_PORT(key) ((size_t) (key) >> 11)
+#define KEY_CHANNEL(key) (((key) >> 7) & 0x0F)
+#define KEY_NOTE(key) ((key) & 0x7F)
+
+/* An output notes go to, with the batch of messages for it.  */
+typedef struct
+{
+  MMOutput *output;
+  MMOutputEvent batch[MAX_BATCH_SIZE];
+  size_t nbatch;
+  unsigned int channels; /* Mask of those played on since killall.  */
+} MMNotePort;
+
+/* An output that gets clock.  Pulses go out OFFSET ms early, MUL of them
+   per 24 ppqn pulse or one every DIV counting from PHASE.  */
+typedef struct
+{
+  MMOutput *output;
+  int offset;
+  unsigned int mul;
+  unsigned int div;
+  unsigned int phase;
+} MMClockPort;
+
 struct _MMPlayer
 {
-  PortMidiStream *stream;
-  MMTimer *timer;
+  MMOutput *output;
+  MMNotePort ports[MAX_NOTE_PORTS];
+  size_t nports;
   int notes[12];
   int nnotes;
+  int velocity;
+  int transpose;
   double bpm;
   unsigned int last_sync;
   double sync_frac;
   unsigned int pulse_count;
+  unsigned int last_pulse;
+  MMStats *jitter;
+  MMClockPort clocks[MAX_CLOCK_PORTS];
+  size_t nclocks;
+  int clock_lead; /* Largest offset, ms.  */
+  bool running;
+  MMOutput *mtc_output;
+  int mtc_fps;
+  double mtc_first;        /* Time of the first quarter frame, output ms.  */
+  unsigned int mtc_frame;  /* Frame of the first quarter frame.  */
+  unsigned int mtc_count;  /* Quarter frames since the first.  */
+  const MMTempoRamp *ramp;
+  double ramp_from;  /* Tempo the ramp was started from.  */
+  unsigned int ramp_pulse;
+  double ramp_start; /* Time of the first pulse, output ms.  */
+  bool slave;
+  bool rewind;
+  unsigned int pll_pulses;
+  double pll_first;  /* Time of the pulse locked on, output ms.  */
+  double pll_time;   /* Filtered time of the last pulse, output ms.  */
+  double pll_period; /* ms.  */
 };
 
 static int beats_to_ms (const MMPlayer *, double);
 static double ms_to_beats (const MMPlayer *, int);
+static void next_ramp_pulse (MMPlayer *);
+static void end_ramp (MMPlayer *);
+static void send_clock (MMPlayer *, double, unsigned int);
+static void send_transport (MMPlayer *, int, unsigned int);
+static void sync_pulse (MMPlayer *, unsigned int);
+static void sync_timecode (MMPlayer *, unsigned int);
+static void locate_timecode (MMPlayer *, double, double, unsigned int);
+static size_t get_port (const MMPlayer *, const MMRoute *);
+static void print_key (int, bool);
 static void send_notes_on (MMPlayer *, int *, int, double, double);
 static void send_notes_off (MMPlayer *, int *, int);
 static int array_diff_int (int *, int, int *, int, int *);
-
-static int
-mm_player_time_proc (void *time_info)
-{
-  MMPlayer *player = (MMPlayer *) time_info;
-  /* Signed 32bit int overflows in about 25 days.  */
-  return (int) mm_timer_get_age (player->timer);
-}
+static void queue (MMPlayer *, size_t, int, int, int, int);
+static bool flush (MMPlayer *);
 
 MMPlayer *
-mm_player_new (PmDeviceID device)
+mm_player_new (MMOutput *output)
 {
   MMPlayer *player = NULL;
-  PmError err;
+
+  assert (output != NULL);
 
   player = calloc (1, sizeof (MMPlayer));
   assert (player != NULL);
-  player->timer = mm_timer_new ();
+  player->output = output;
+  player->ports[0].output = output;
+  player->ports[0].nbatch = 0;
+  player->ports[0].channels = 0;
+  player->nports = 1;
+  player->velocity = 0x7F;
+  player->transpose = 0;
   player->bpm = 120.;
   player->last_sync = 0;
   player->sync_frac = 0.;
   player->pulse_count = 0;
-
-  err = Pm_OpenOutput (&player->stream, device, NULL, 32,
-                       mm_player_time_proc, player, 1);
-  if (err < pmNoError || player->stream == NULL)
-    {
-      mm_player_free (player);
-      MMERR ("MIDI Device " MMCY ("%d") " could not be opened: " MMCY ("%s"),
-             device, Pm_GetErrorText (err));
-      return NULL;
-    }
+  player->last_pulse = 0;
+  player->jitter = mm_stats_new ("clock_jitter");
+  player->clocks[0] = (MMClockPort) { output, 0, 1, 1, 0 };
+  player->nclocks = 1;
+  player->clock_lead = 0;
+  player->running = false;
+  player->mtc_output = NULL;
+  player->mtc_fps = 0;
+  player->ramp = NULL;
+  player->slave = false;
+  player->rewind = false;
+  player->pll_pulses = 0;
 
   return player;
 }
@@ -81,9 +165,20 @@ mm_player_free (MMPlayer *player)
 {
   if (player != NULL)
     {
-      if (player->stream != NULL)
-        Pm_Close (player->stream);
-      mm_timer_free (player->timer);
+      bool mtc_shared = player->mtc_output == player->output;
+      for (size_t i = 0; i < player->nclocks; ++i)
+        {
+          if (player->clocks[i].output == player->mtc_output)
+            mtc_shared = true;
+          if (player->clocks[i].output != player->output)
+            mm_output_free (player->clocks[i].output);
+        }
+      if (!mtc_shared)
+        mm_output_free (player->mtc_output);
+      for (size_t i = 1; i < player->nports; ++i)
+        mm_output_free (player->ports[i].output);
+      mm_output_free (player->output);
+      mm_stats_free (player->jitter);
       free (player);
     }
 }
@@ -91,23 +186,50 @@ mm_player_free (MMPlayer *player)
 bool
 mm_player_send (MMPlayer *player, int status, int data1, int data2, int delay)
 {
-  PmEvent event;
-  PmError err;
-
   if (player == NULL)
     return false;
 
-  event.message = Pm_Message (status, data1, data2);
-  event.timestamp = mm_player_time_proc (player) + delay;
-  err = Pm_Write (player->stream, &event, 1);
-  if (err < pmNoError)
+  queue (player, 0, status, data1, data2, delay);
+  return flush (player);
+}
+
+/* Sends a channel message to the port and channel of ROUTE.  */
+bool
+mm_player_send_to (MMPlayer *player, const MMRoute *route, int status,
+                   int data1, int data2, int delay)
+{
+  if (player == NULL || route == NULL)
+    return false;
+
+  queue (player, get_port (player, route),
+         (status & 0xF0) | (route->channel > 0 ? route->channel : 0),
+         data1, data2, delay);
+  return flush (player);
+}
+
+/* Adds OUTPUT as the next port notes can be routed to, numbered from 1
+   after the output of PLAYER.  PLAYER frees OUTPUT once it is added.
+   Returns the port number, or -1.  */
+int
+mm_player_add_port (MMPlayer *player, MMOutput *output)
+{
+  MMNotePort *port;
+
+  if (player == NULL || output == NULL)
+    return -1;
+
+  if (player->nports == MAX_NOTE_PORTS)
     {
-      MMERR ("Message " MMCY ("0x%X") " returned " MMCY ("%s"),
-             event.message, Pm_GetErrorText (err));
-      return false;
+      MMERR ("Maximum of " MMCY ("%d") " ports reached", MAX_NOTE_PORTS);
+      return -1;
     }
 
-  return true;
+  port = &player->ports[player->nports];
+  port->output = output;
+  port->nbatch = 0;
+  port->channels = 0;
+
+  return (int) player->nports++;
 }
 
 void
@@ -115,14 +237,28 @@ mm_player_play (MMPlayer *player, const MMChord *chord)
 {
   int nnotes = 12;
   int notes[nnotes];
+  const MMRoute *route, *bass;
 
   if (player == NULL || chord == NULL)
     return;
 
   mm_print_cmd ("PLAYING", true);
-  printf (MMCB ("%s") "\n", mm_chord_get_name (chord));
+  MMUI (MMCB ("%s") "\n", mm_chord_get_name (chord));
 
+  MM_TRACE_BEGIN (start);
   nnotes = mm_chord_get_notes (chord, notes, nnotes);
+  route = mm_chord_get_route (chord);
+  bass = mm_chord_get_bass_route (chord);
+  if (bass->port < 0 && bass->channel < 0)
+    bass = route;
+  for (int i = 0; i < nnotes; ++i)
+    {
+      const MMRoute *layer = i == 0 ? bass : route;
+      int note = (int) fmin (fmax (notes[i] + player->transpose, 0.), 127.);
+      notes[i] = NOTE_KEY (get_port (player, layer),
+                           layer->channel > 0 ? layer->channel : 0, note);
+    }
+  MM_TRACE_END (MMTP_CHORD_NOTES, start, nnotes);
 
   if (mm_chord_get_lift (chord))
     {
@@ -149,6 +285,7 @@ mm_player_play (MMPlayer *player, const MMChord *chord)
                      mm_chord_get_broken (chord));
     }
 
+  flush (player);
   mm_print_cmd_end ();
 
   memcpy (player->notes, notes, sizeof (int) * nnotes);
@@ -163,17 +300,95 @@ mm_player_killall (MMPlayer *player)
   mm_print_cmd ("KILL ALL", false);
   player->nnotes = 0;
   memset (player->notes, 0, sizeof (int) * 12);
-  return mm_player_send (player, 0xB0, 0x7B, 0x00, 0);
+
+  /* The output cache drops this where no note has sounded since.  */
+  player->ports[0].channels |= 1;
+  for (size_t i = 0; i < player->nports; ++i)
+    {
+      for (int channel = 0; channel < 16; ++channel)
+        {
+          if (player->ports[i].channels & (1 << channel))
+            queue (player, i, 0xB0 | channel, 0x7B, 0x00, 0);
+        }
+      player->ports[i].channels = 0;
+    }
+
+  return flush (player);
 }
 
 void
 mm_player_set_bpm (MMPlayer *player, double bpm)
 {
-  if (player != NULL && bpm > 0.)
+  /* The external clock has the last word.  */
+  if (player != NULL && bpm > 0. && !player->slave)
     {
       player->bpm = bpm;
+      end_ramp (player);
+      player->last_pulse = 0;
+      mm_output_set_tempo (player->output, bpm);
       mm_print_cmd ("BPM", true);
-      printf (MMCB ("%.2f") "\n", player->bpm);
+      MMUI (MMCB ("%.2f") "\n", player->bpm);
+      mm_print_cmd_end ();
+    }
+}
+
+double
+mm_player_get_bpm (const MMPlayer *player)
+{
+  return (player != NULL) ? player->bpm : 0.;
+}
+
+/* Runs the clock through RAMP from the last pulse sent, starting from
+   the tempo at that pulse so that loops, seeks and taps since the
+   program was loaded do not make it jump.  Replaces any ramp in
+   progress, NULL just ending it.  RAMP must outlive its use, as the
+   tempo map of a loaded program does.  */
+void
+mm_player_set_ramp (MMPlayer *player, const MMTempoRamp *ramp)
+{
+  double now;
+
+  if (player == NULL || player->slave)
+    return;
+
+  end_ramp (player);
+  if (ramp == NULL)
+    return;
+
+  now = (double) mm_output_get_time (player->output);
+  player->ramp = ramp;
+  player->ramp_from = player->bpm;
+  player->ramp_pulse = 0;
+  player->ramp_start = fmax (player->last_sync + player->sync_frac, now);
+  player->last_pulse = 0;
+  mm_print_cmd ("RAMP", true);
+  MMUI (MMCB ("%.2f") " → " MMCB ("%.2f") " in " MMCY ("%g") " beats\n",
+        player->ramp_from, mm_tempo_ramp_get_to (ramp),
+        mm_tempo_ramp_get_length (ramp) / 24.);
+  mm_print_cmd_end ();
+}
+
+void
+mm_player_set_velocity (MMPlayer *player, int velocity)
+{
+  if (player != NULL && velocity > 0 && velocity <= 0x7F
+      && velocity != player->velocity)
+    {
+      player->velocity = velocity;
+      mm_print_cmd ("VELOCITY", true);
+      MMUI (MMCB ("%d") "\n", player->velocity);
+      mm_print_cmd_end ();
+    }
+}
+
+void
+mm_player_set_transpose (MMPlayer *player, int transpose)
+{
+  if (player != NULL && transpose != player->transpose)
+    {
+      player->transpose = transpose;
+      mm_print_cmd ("TRANSPOSE", true);
+      MMUI (MMCB ("%+d") "\n", player->transpose);
       mm_print_cmd_end ();
     }
 }
@@ -181,31 +396,202 @@ mm_player_set_bpm (MMPlayer *player, double bpm)
 void
 mm_player_sync_clock (MMPlayer *player)
 {
-  double toi; /* integral timeout part.  */
-  double tof; /* fractional timeout part.  */
   unsigned int now;
 
-  if (player == NULL || player->bpm <= 0.)
+  if (player == NULL || player->bpm <= 0. || player->slave)
     return;
 
-  now = mm_timer_get_age (player->timer);
-  if (player->last_sync > now)
-    return;
+  /* Run ahead of time by the largest port offset, so every port gets its
+     pulse before it is due.  */
+  now = mm_output_get_time (player->output);
+  if (player->last_sync <= now + player->clock_lead)
+    sync_pulse (player, now);
+
+  if (player->mtc_fps > 0 && player->running)
+    sync_timecode (player, now);
+}
+
+/* Moves the clock grid so that a beat fell MS_AGO ms ago, keeping the
+   beat count where it was up to the nearest whole beat.  The pulse
+   already scheduled is replaced by the grid pulse closest to it.  */
+bool
+mm_player_align_beat (MMPlayer *player, double ms_ago)
+{
+  double now, period, t0, ref, grid, whole;
+  long beat0, k, count;
+  MMBeat beat;
 
-  tof = modf (2500. / player->bpm, &toi); /* 24 ppqn.  */
-  while (player->last_sync <= now)
+  if (player == NULL || player->slave
+      || !mm_player_get_beat (player, &beat))
+    return false;
+
+  now = (double) mm_output_get_time (player->output);
+  period = 2500. / player->bpm;
+  t0 = now - ms_ago;
+  beat0 = lround (beat.i + beat.f - ms_ago * player->bpm / 60000.);
+
+  ref = player->last_sync + player->sync_frac;
+  if (ref > now)
+    k = lround ((ref - t0) / period);
+  else
+    k = (long) floor ((now - t0) / period);
+
+  count = beat0 * 24 + k;
+  grid = t0 + k * period;
+  if (count < 0 || grid < 0.)
+    return false;
+
+  player->pulse_count = (unsigned int) count;
+  player->sync_frac = modf (grid, &whole);
+  player->last_sync = (unsigned int) whole;
+  player->last_pulse = 0;
+
+  return true;
+}
+
+/* Sends clock to OUTPUT, or changes how it is sent if OUTPUT already
+   gets it.  NULL is the output of PLAYER, which gets 24 ppqn on time
+   unless told otherwise.  Pulses go out OFFSET ms early, for gear that
+   responds late, at a PPQN that divides 24 or is a multiple of it, 0
+   stopping them.  PLAYER frees OUTPUT once it is added.  */
+bool
+mm_player_set_clock (MMPlayer *player, MMOutput *output, int offset,
+                     int ppqn)
+{
+  MMClockPort *port = NULL;
+
+  if (player == NULL)
+    return false;
+
+  if (ppqn < 0
+      || (ppqn > 0 && 24 % ppqn != 0
+          && (ppqn % 24 != 0 || ppqn / 24 > MAX_CLOCK_MUL)))
     {
-      player->last_sync += toi;
-      player->sync_frac += tof;
-      if (player->sync_frac >= 1.)
+      MMERR ("Unsupported clock resolution " MMCY ("%d") " ppqn", ppqn);
+      return false;
+    }
+
+  if (output == NULL)
+    output = player->output;
+
+  for (size_t i = 0; i < player->nclocks && port == NULL; ++i)
+    {
+      if (player->clocks[i].output == output)
+        port = &player->clocks[i];
+    }
+
+  if (port == NULL)
+    {
+      if (player->nclocks == MAX_CLOCK_PORTS)
         {
-          player->last_sync += 1;
-          player->sync_frac -= 1.;
+          MMERR ("Maximum of " MMCY ("%d") " clock outputs reached",
+                 MAX_CLOCK_PORTS);
+          return false;
         }
+      port = &player->clocks[player->nclocks++];
+      port->output = output;
+      port->phase = 0;
     }
 
-  mm_player_send (player, 0xF8, 0x00, 0x00, player->last_sync - now);
-  ++player->pulse_count;
+  port->offset = offset;
+  port->mul = ppqn > 24 ? ppqn / 24 : (ppqn > 0 ? 1 : 0);
+  port->div = ppqn > 0 && ppqn <= 24 ? 24 / ppqn : 1;
+
+  player->clock_lead = 0;
+  for (size_t i = 0; i < player->nclocks; ++i)
+    {
+      if (player->clocks[i].mul > 0
+          && player->clocks[i].offset > player->clock_lead)
+        player->clock_lead = player->clocks[i].offset;
+    }
+
+  return true;
+}
+
+/* Sends MIDI time code at FPS frames per second to OUTPUT, NULL being
+   the output of PLAYER, or stops it at 0.  Time code runs with the
+   transport, zero at start.  PLAYER frees OUTPUT.  */
+bool
+mm_player_set_timecode (MMPlayer *player, MMOutput *output, int fps)
+{
+  if (player == NULL)
+    return false;
+
+  if (fps != 0 && fps != 24 && fps != 25 && fps != 30)
+    {
+      MMERR ("Unsupported time code rate " MMCY ("%d") " fps", fps);
+      return false;
+    }
+
+  if (output == NULL)
+    output = player->output;
+
+  if (player->mtc_output != NULL && player->mtc_output != output)
+    {
+      MMERR ("Time code already goes to " MMCY ("%s"),
+             mm_output_get_name (player->mtc_output));
+      return false;
+    }
+
+  player->mtc_output = output;
+  player->mtc_fps = fps;
+  player->mtc_count = 0;
+
+  return true;
+}
+
+/* Starts clock slaves from the top now.  */
+void
+mm_player_start (MMPlayer *player)
+{
+  if (player == NULL || player->slave || player->bpm <= 0.)
+    return;
+  send_transport (player, 0xFA, 0);
+}
+
+/* Moves clock slaves to BEAT and has them continue from there now,
+   stopping them first if running.  */
+void
+mm_player_locate (MMPlayer *player, double beat)
+{
+  long position = lround (fmax (beat, 0.) * 4.);
+
+  if (player == NULL || player->slave || player->bpm <= 0.)
+    return;
+  send_transport (player, 0xFB,
+                  position > 0x3FFF ? 0x3FFF : (unsigned int) position);
+}
+
+/* Stops clock slaves right after the last pulse sent.  */
+void
+mm_player_stop (MMPlayer *player)
+{
+  MMOutputEvent event;
+  unsigned int now;
+
+  if (player == NULL || player->slave || !player->running)
+    return;
+  player->running = false;
+
+  now = mm_output_get_time (player->output);
+  for (size_t i = 0; i < player->nclocks; ++i)
+    {
+      MMClockPort *port = &player->clocks[i];
+      int delay = (int) player->last_sync - port->offset - (int) now;
+
+      if (port->mul == 0)
+        continue;
+      event.message = MM_MESSAGE (0xFC, 0x00, 0x00);
+      event.timestamp = mm_output_get_time (port->output)
+        + (delay > 0 ? delay : 0);
+      mm_output_write (port->output, &event, 1);
+    }
+}
+
+bool
+mm_player_get_running (const MMPlayer *player)
+{
+  return (player != NULL && player->running) ? true : false;
 }
 
 bool
@@ -216,7 +602,7 @@ mm_player_get_beat (const MMPlayer *player, MMBeat *beat)
   if (player == NULL || beat == NULL || player->bpm <= 0.)
     return false;
 
-  sync_dist = (int) mm_timer_get_age (player->timer) - player->last_sync;
+  sync_dist = (int) mm_output_get_time (player->output) - player->last_sync;
   beat->i = player->pulse_count / 24;
   beat->f = (double) (player->pulse_count % 24) / 24.;
   beat->f += ms_to_beats (player, sync_dist);
@@ -240,12 +626,389 @@ mm_player_get_time_to_beat (const MMPlayer *player, MMBeat *beat)
   return beats_to_ms (player, diff);
 }
 
+MMStats *
+mm_player_get_jitter (MMPlayer *player)
+{
+  return (player != NULL) ? player->jitter : NULL;
+}
+
+/* In slave mode the player stops generating clock and follows the pulses
+   given to mm_player_clock_pulse instead.  */
+void
+mm_player_set_slave (MMPlayer *player, bool slave)
+{
+  if (player != NULL)
+    {
+      player->slave = slave;
+      end_ramp (player);
+      player->pll_pulses = 0;
+    }
+}
+
+bool
+mm_player_get_slave (const MMPlayer *player)
+{
+  return (player != NULL && player->slave) ? true : false;
+}
+
+/* Rewinds to beat zero, the next pulse being its first.  */
+void
+mm_player_clock_start (MMPlayer *player)
+{
+  if (player != NULL && player->slave)
+    {
+      player->pulse_count = 0;
+      player->rewind = true;
+    }
+}
+
+/* Feeds an external clock pulse that arrived at TIME, in mm_time_us ()
+   microseconds.  The filtered pulse time and tempo are what beats and
+   triggers are computed from, and the clock jitter statistics record how
+   far pulses land from where the filter expects them.  */
+void
+mm_player_clock_pulse (MMPlayer *player, uint64_t time)
+{
+  uint64_t now_us = mm_time_us ();
+  double t, error, whole;
+
+  if (player == NULL || !player->slave)
+    return;
+
+  t = (double) mm_output_get_time (player->output)
+    - (now_us > time ? (double) (now_us - time) / 1000. : 0.);
+
+  error = t - (player->pll_time + player->pll_period);
+  if (player->pll_pulses == 0 || fabs (error) > player->pll_period)
+    {
+      /* (Re)lock on this pulse.  */
+      if (player->pll_pulses == 0)
+        player->pll_period = 2500. / player->bpm;
+      player->pll_pulses = 0;
+      player->pll_first = t;
+      player->pll_time = t;
+    }
+  else
+    {
+      player->pll_time += player->pll_period + PLL_ALPHA * error;
+      /* Average the period over the first beat, then track it.  */
+      if (player->pll_pulses < 24)
+        player->pll_period = (t - player->pll_first) / player->pll_pulses;
+      else
+        player->pll_period += PLL_BETA * error;
+      player->pll_period = fmin (fmax (player->pll_period,
+                                       2500. / PLL_MAX_BPM),
+                                 2500. / PLL_MIN_BPM);
+      mm_stats_record (player->jitter, (unsigned int) (fabs (error) * 1000.));
+    }
+
+  ++player->pll_pulses;
+  if (player->rewind)
+    player->rewind = false;
+  else
+    ++player->pulse_count;
+  player->bpm = 2500. / player->pll_period;
+  player->sync_frac = modf (player->pll_time, &whole);
+  player->last_sync = (unsigned int) whole;
+}
+
+static void
+sync_pulse (MMPlayer *player, unsigned int now)
+{
+  double toi; /* integral timeout part.  */
+  double tof; /* fractional timeout part.  */
+  double prev = player->last_sync;
+
+  while (player->last_sync <= now + player->clock_lead)
+    {
+      if (player->ramp != NULL)
+        {
+          next_ramp_pulse (player);
+          continue;
+        }
+      tof = modf (2500. / player->bpm, &toi); /* 24 ppqn.  */
+      player->last_sync += toi;
+      player->sync_frac += tof;
+      if (player->sync_frac >= 1.)
+        {
+          player->last_sync += 1;
+          player->sync_frac -= 1.;
+        }
+    }
+
+  /* Pulses go out on a whole ms grid, so jitter is the distance between
+     the scheduled and the ideal pulse period.  A pulse skipped because
+     the loop woke up too late shows up as a whole extra period.  */
+  if (player->last_pulse > 0)
+    {
+      double period = (player->last_sync - player->last_pulse) * 1000.;
+      mm_stats_record (player->jitter,
+                       (unsigned int) fabs (period - 2500000. / player->bpm));
+    }
+  player->last_pulse = player->last_sync;
+
+  MM_TRACE_BEGIN (start);
+  send_clock (player, prev, now);
+  MM_TRACE_END (MMTP_CLOCK, start, player->pulse_count);
+  ++player->pulse_count;
+}
+
+static void
+frame_to_timecode (unsigned int frame, int fps, unsigned char *timecode)
+{
+  timecode[3] = frame % fps;
+  frame /= fps;
+  timecode[2] = frame % 60;
+  frame /= 60;
+  timecode[1] = frame % 60;
+  frame /= 60;
+  timecode[0] = frame % 24;
+}
+
+static int
+timecode_rate (int fps)
+{
+  return fps == 24 ? 0 : (fps == 25 ? 1 : 3);
+}
+
+/* Sends quarter frames up to the last clock pulse sent, 8 of them
+   spelling out the time of every other frame, hours first in the last.  */
+static void
+sync_timecode (MMPlayer *player, unsigned int now)
+{
+  MMOutputEvent events[MAX_MTC_BATCH];
+  double period = 250. / player->mtc_fps;
+  unsigned int base = mm_output_get_time (player->mtc_output);
+  size_t n = 0;
+  double t;
+
+  while (n < MAX_MTC_BATCH
+         && (t = player->mtc_first + player->mtc_count * period)
+            <= player->last_sync)
+    {
+      unsigned char timecode[4];
+      unsigned int piece = player->mtc_count % 8;
+      int value;
+
+      frame_to_timecode (player->mtc_frame + (player->mtc_count / 8) * 2,
+                         player->mtc_fps, timecode);
+      value = timecode[3 - piece / 2];
+      value = (piece % 2) ? value >> 4 : value & 0x0F;
+      if (piece == 7)
+        value |= timecode_rate (player->mtc_fps) << 1;
+
+      events[n].message = MM_MESSAGE (0xF1, (piece << 4) | value, 0x00);
+      events[n].timestamp = base
+        + (t > now ? (unsigned int) lround (t - now) : 0);
+      ++n;
+      ++player->mtc_count;
+    }
+
+  mm_output_write (player->mtc_output, events, n);
+}
+
+/* Sends a full frame for SONG ms into the program at TIME and restarts
+   quarter frames from the frame after it.  */
+static void
+locate_timecode (MMPlayer *player, double time, double song,
+                 unsigned int now)
+{
+  unsigned char sysex[] = {
+    0xF0, 0x7F, 0x7F, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0xF7
+  };
+  double frame_ms = 1000. / player->mtc_fps;
+  unsigned int frame = (unsigned int) floor (song / frame_ms);
+  unsigned int base = mm_output_get_time (player->mtc_output);
+
+  frame_to_timecode (frame, player->mtc_fps, &sysex[5]);
+  sysex[5] |= timecode_rate (player->mtc_fps) << 5;
+  mm_output_write_sysex (player->mtc_output, sysex, sizeof (sysex),
+                         base + (time > now
+                                 ? (unsigned int) lround (time - now) : 0));
+
+  if (frame * frame_ms < song)
+    ++frame;
+  player->mtc_frame = frame;
+  player->mtc_first = time + frame * frame_ms - song;
+  player->mtc_count = 0;
+}
+
+/* Steps the clock to the next pulse in the ramp table.  */
+static void
+next_ramp_pulse (MMPlayer *player)
+{
+  const MMTempoRamp *ramp = player->ramp;
+  double time, whole;
+
+  ++player->ramp_pulse;
+  time = player->ramp_start
+    + mm_tempo_ramp_get_time (ramp, player->ramp_from, player->ramp_pulse);
+  player->sync_frac = modf (time, &whole);
+  player->last_sync = (unsigned int) whole;
+  player->bpm = mm_tempo_ramp_get_bpm (ramp, player->ramp_from,
+                                       player->ramp_pulse);
+
+  if (player->ramp_pulse >= mm_tempo_ramp_get_length (ramp))
+    {
+      player->bpm = mm_tempo_ramp_get_to (ramp);
+      end_ramp (player);
+      mm_output_set_tempo (player->output, player->bpm);
+    }
+  else if (player->ramp_pulse % 24 == 0)
+    mm_output_set_tempo (player->output, player->bpm);
+}
+
+static void
+end_ramp (MMPlayer *player)
+{
+  player->ramp = NULL;
+}
+
+/* Sends the pulse at LAST_SYNC to every clock port in one pass.  Ports
+   faster than 24 ppqn get theirs spread evenly since the pulse at PREV.
+   Timestamps are moved from the time base of the player output, at NOW,
+   to that of each port.  */
+static void
+send_clock (MMPlayer *player, double prev, unsigned int now)
+{
+  MMOutputEvent events[MAX_CLOCK_MUL];
+  double next = player->last_sync;
+  double period = 2500. / player->bpm;
+
+  if (prev > next || next - prev > 2. * period)
+    prev = next - period;
+
+  for (size_t i = 0; i < player->nclocks; ++i)
+    {
+      MMClockPort *port = &player->clocks[i];
+      unsigned int base;
+
+      if (port->mul == 0
+          || (player->pulse_count - port->phase) % port->div != 0)
+        continue;
+
+      base = (port->output == player->output)
+        ? now : mm_output_get_time (port->output);
+      for (unsigned int j = 0; j < port->mul; ++j)
+        {
+          double t = prev + (next - prev) * (j + 1) / port->mul
+            - port->offset;
+          events[j] = (MMOutputEvent) {
+            MM_MESSAGE (0xF8, 0x00, 0x00),
+            base + (t > now ? (unsigned int) lround (t - now) : 0)
+          };
+        }
+      mm_output_write (port->output, events, port->mul);
+    }
+}
+
+/* Sends TRANSPORT, a start or a continue from POSITION 16th notes, to
+   every clock port right away, moving the pulse grid so that its pulse
+   is now and goes out with it.  Pulses already sent for after now can
+   not be taken back, so they count as the ones following on the new
+   grid.  Ports short of those get the rest before them, ports slower
+   than 24 ppqn with one among them count from it instead.  */
+static void
+send_transport (MMPlayer *player, int transport, unsigned int position)
+{
+  MMOutputEvent events[4];
+  unsigned int now = mm_output_get_time (player->output);
+  double period = 2500. / player->bpm;
+  double last = player->last_sync + player->sync_frac;
+  double next, whole;
+  unsigned int ahead = 0;
+
+  if (last > now)
+    ahead = (unsigned int) ceil ((last - now) / period);
+
+  for (size_t i = 0; i < player->nclocks; ++i)
+    {
+      MMClockPort *port = &player->clocks[i];
+      unsigned int base, sent = 0, first = 0, missing;
+      double until;
+      size_t n = 0;
+
+      if (port->mul == 0)
+        continue;
+
+      base = (port->output == player->output)
+        ? now : mm_output_get_time (port->output);
+      until = now + ahead * period - port->offset;
+      for (unsigned int k = 1; k <= ahead; ++k)
+        {
+          unsigned int count = player->pulse_count - 1 - (ahead - k);
+
+          if ((count - port->phase) % port->div != 0)
+            continue;
+          for (unsigned int j = 1; j <= port->mul; ++j)
+            {
+              double t = last - (ahead - k) * period
+                - (port->mul - j) * period / port->mul - port->offset;
+
+              if (lround (t - now) <= 0)
+                continue;
+              if (sent++ == 0)
+                {
+                  first = k;
+                  until = t;
+                }
+            }
+        }
+
+      if (player->running && transport == 0xFB)
+        events[n++] = (MMOutputEvent) { MM_MESSAGE (0xFC, 0x00, 0x00), base };
+      if (transport == 0xFB)
+        events[n++] = (MMOutputEvent) {
+          MM_MESSAGE (0xF2, position & 0x7F, (position >> 7) & 0x7F), base
+        };
+      events[n++] = (MMOutputEvent) { MM_MESSAGE (transport, 0x00, 0x00),
+                                      base };
+      if (port->div > 1 && sent > 0)
+        {
+          port->phase = player->pulse_count + first;
+          missing = 0;
+        }
+      else
+        {
+          events[n++] = (MMOutputEvent) { MM_MESSAGE (0xF8, 0x00, 0x00),
+                                          base };
+          port->phase = player->pulse_count;
+          missing = (port->div > 1 ? ahead / port->div : ahead * port->mul)
+            - sent;
+        }
+      mm_output_write (port->output, events, n);
+
+      for (unsigned int j = 1; j <= missing; ++j)
+        {
+          double t = now + (until - now) * j / (missing + (sent > 0));
+
+          events[0] = (MMOutputEvent) {
+            MM_MESSAGE (0xF8, 0x00, 0x00),
+            base + (t > now ? (unsigned int) lround (t - now) : 0)
+          };
+          mm_output_write (port->output, events, 1);
+        }
+    }
+
+  next = now + ahead * period;
+  if (player->ramp != NULL)
+    player->ramp_start += next - last;
+  player->sync_frac = modf (next, &whole);
+  player->last_sync = (unsigned int) whole;
+  player->pulse_count += ahead + 1;
+  player->last_pulse = 0;
+
+  if (player->mtc_fps > 0)
+    locate_timecode (player, now, position * 15000. / player->bpm, now);
+  player->running = true;
+}
+
 static int
 beats_to_ms (const MMPlayer *player, double beats)
 {
   if (player->bpm <= 0. || beats == 0.)
     return 0;
-  return (int) ((60000. / player->bpm) * beats);
+  return (int) round ((60000. / player->bpm) * beats);
 }
 
 static double
@@ -256,6 +1019,32 @@ ms_to_beats (const MMPlayer *player, int ms)
   return (double) ms / (60000. / player->bpm);
 }
 
+/* Returns the port of ROUTE, the output of PLAYER if it has no such
+   port.  */
+static size_t
+get_port (const MMPlayer *player, const MMRoute *route)
+{
+  return route->port > 0 && (size_t) route->port < player->nports
+    ? (size_t) route->port : 0;
+}
+
+/* Prints the note of KEY, followed by its port and channel when they
+   are not the first.  */
+static void
+print_key (int key, bool on)
+{
+  if (on)
+    MMUI (MMCG ("%d"), KEY_NOTE (key));
+  else
+    MMUI (MMCY ("%d"), KEY_NOTE (key));
+
+  if (KEY_PORT (key) > 0)
+    MMUI ("@%zu:%d", KEY_PORT (key), KEY_CHANNEL (key) + 1);
+  else if (KEY_CHANNEL (key) > 0)
+    MMUI ("@%d", KEY_CHANNEL (key) + 1);
+  MMUI (" ");
+}
+
 static void
 send_notes_on (MMPlayer *player, int *notes, int nnotes, double delay,
                double broken)
@@ -269,13 +1058,16 @@ send_notes_on (MMPlayer *player, int *notes, int nnotes, double delay,
        (up && (i < nnotes)) || (!up && (i >= 0));
        i += (up ? 1 : -1))
     {
-      printf (MMCG ("%d") " ", notes[i]);
+      print_key (notes[i], true);
       if (offset > 0)
-        printf ("+%d ", offset);
-      mm_player_send (player, 0x90, notes[i], 0x7F, offset);
+        MMUI ("+%d ", offset);
+      queue (player, KEY_PORT (notes[i]), 0x90 | KEY_CHANNEL (notes[i]),
+             KEY_NOTE (notes[i]), player->velocity, offset);
+      player->ports[KEY_PORT (notes[i])].channels
+        |= 1 << KEY_CHANNEL (notes[i]);
       offset += delta;
     }
-  printf ("\n");
+  MMUI ("\n");
 }
 
 static void
@@ -284,10 +1076,11 @@ send_notes_off (MMPlayer *player, int *notes, int nnotes)
   mm_print_cmd ("OFF", true);
   for (int i = 0; i < nnotes; ++i)
     {
-      mm_player_send (player, 0x80, notes[i], 0x40, 0);
-      printf (MMCY ("%d") " ", notes[i]);
+      queue (player, KEY_PORT (notes[i]), 0x80 | KEY_CHANNEL (notes[i]),
+             KEY_NOTE (notes[i]), 0x40, 0);
+      print_key (notes[i], false);
     }
-  printf ("\n");
+  MMUI ("\n");
 }
 
 static int
@@ -310,3 +1103,40 @@ array_diff_int (int *a, int alen, int *b, int blen, int *diff)
     }
   return dlen;
 }
+
+static void
+queue (MMPlayer *player, size_t port, int status, int data1, int data2,
+       int delay)
+{
+  MMNotePort *dest = &player->ports[port];
+  MMOutputEvent *event;
+
+  if (dest->nbatch == MAX_BATCH_SIZE)
+    flush (player);
+
+  event = &dest->batch[dest->nbatch++];
+  event->message = MM_MESSAGE (status, data1, data2);
+  event->timestamp = mm_output_get_time (dest->output) + delay;
+}
+
+/* Writes the batch of every port.  Timestamps are set as the messages
+   are queued, so ports written one after the other still play
+   together.  */
+static bool
+flush (MMPlayer *player)
+{
+  bool written = true;
+
+  for (size_t i = 0; i < player->nports; ++i)
+    {
+      MMNotePort *port = &player->ports[i];
+
+      if (port->nbatch == 0)
+        continue;
+      if (!mm_output_write (port->output, port->batch, port->nbatch))
+        written = false;
+      port->nbatch = 0;
+    }
+
+  return written;
+}
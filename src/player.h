@@ -19,11 +19,13 @@
 #define MM_PLAYER_H 1
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
 
-#include <portmidi.h>
-
 #include "chord.h"
+#include "output.h"
+#include "stats.h"
+#include "tempo.h"
 
 typedef struct _MMPlayer MMPlayer;
 
@@ -33,15 +35,33 @@ typedef struct
   double f;
 } MMBeat;
 
-MMPlayer *mm_player_new (PmDeviceID);
+MMPlayer *mm_player_new (MMOutput *);
 void mm_player_free (MMPlayer *);
 bool mm_player_send (MMPlayer *, int, int, int, int);
+bool mm_player_send_to (MMPlayer *, const MMRoute *, int, int, int, int);
+int mm_player_add_port (MMPlayer *, MMOutput *);
 void mm_player_play (MMPlayer *, const MMChord *);
 bool mm_player_killall (MMPlayer *);
 void mm_player_set_bpm (MMPlayer *, double);
+double mm_player_get_bpm (const MMPlayer *);
+void mm_player_set_ramp (MMPlayer *, const MMTempoRamp *);
+void mm_player_set_velocity (MMPlayer *, int);
+void mm_player_set_transpose (MMPlayer *, int);
 void mm_player_sync_clock (MMPlayer *);
+bool mm_player_set_clock (MMPlayer *, MMOutput *, int, int);
+bool mm_player_set_timecode (MMPlayer *, MMOutput *, int);
+void mm_player_start (MMPlayer *);
+void mm_player_locate (MMPlayer *, double);
+void mm_player_stop (MMPlayer *);
+bool mm_player_get_running (const MMPlayer *);
+bool mm_player_align_beat (MMPlayer *, double);
 bool mm_player_get_beat (const MMPlayer *, MMBeat *);
 int mm_player_get_time_to_beat (const MMPlayer *, MMBeat *);
+MMStats *mm_player_get_jitter (MMPlayer *);
+void mm_player_set_slave (MMPlayer *, bool);
+bool mm_player_get_slave (const MMPlayer *);
+void mm_player_clock_pulse (MMPlayer *, uint64_t);
+void mm_player_clock_start (MMPlayer *);
 
 static inline void
 mm_beat_addf (MMBeat *beat, double addition)
@@ -23,8 +23,8 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
-#include <unistd.h>
-#include <sys/ioctl.h>
+
+#include "console.h"
 
 #define MM_VLINE 10
 
@@ -37,17 +37,17 @@
 #define MMCY(string) \
   "\e[0;33m" string "\e[39m"
 
-#define MMERR(format, ...)                                    \
-  fprintf (stderr, MMCR ("ERROR") " in %s(%d): " format "\n", \
-           __FILE__, __LINE__, ##__VA_ARGS__)
+#define MMERR(format, ...)                                     \
+  mm_eprintf (MMCR ("ERROR") " in %s(%d): " format "\n",        \
+              __FILE__, __LINE__, ##__VA_ARGS__)
 
-static inline int
-mm_screen_width ()
-{
-  struct winsize size;
-  ioctl (STDOUT_FILENO, TIOCGWINSZ, &size);
-  return size.ws_col;
-}
+#define MMUI(format, ...)                                      \
+  do                                                           \
+    {                                                          \
+      if (MM_UI)                                               \
+        mm_printf (format, ##__VA_ARGS__);                     \
+    }                                                          \
+  while (0)
 
 static inline size_t
 mm_string_width (const char *str)
@@ -133,24 +133,24 @@ mm_print_break (const char *beg, const char *ver, const char *mid,
     pad = (width / 2) - (blen > elen ? blen : elen);
 
   for (; pos < pad; ++pos)
-    printf (" ");
+    mm_printf (" ");
 
-  printf ("%s", beg);
+  mm_printf ("%s", beg);
   pos += blen;
 
   for (; pos < MM_VLINE; pos += mlen)
-    printf ("%s", mid);
+    mm_printf ("%s", mid);
 
   if (pos == MM_VLINE)
     {
-      printf ("%s", ver);
+      mm_printf ("%s", ver);
       pos += vlen;
     }
 
   for (; pos < width - elen - pad; pos += mlen)
-    printf ("%s", mid);
+    mm_printf ("%s", mid);
 
-  printf ("%s\n", end);
+  mm_printf ("%s\n", end);
 }
 
 static inline void
@@ -169,21 +169,21 @@ mm_print_centered (const char *str, const char *beg, const char *end,
     pad = (width / 2) - (slen / 2) - (blen > elen ? blen : elen);
 
   for (; pos < pad; ++pos)
-    printf (" ");
+    mm_printf (" ");
 
-  printf ("%s", beg);
+  mm_printf ("%s", beg);
   pos += blen;
 
   for (; pos < (width / 2) - (slen / 2); ++pos)
-    printf (" ");
+    mm_printf (" ");
 
-  printf ("%s", str);
+  mm_printf ("%s", str);
   pos += slen;
 
   for (; pos < width - elen - pad; ++pos)
-    printf (" ");
+    mm_printf (" ");
 
-  printf ("%s\n", end);
+  mm_printf ("%s\n", end);
 }
 
 static inline void
@@ -227,6 +227,10 @@ static inline void
 mm_printf_title (const char *format, ...)
 {
   va_list ap;
+
+  if (!MM_UI)
+    return;
+
   va_start (ap, format);
   mm_vprintf_box (format, ap, 1,
                   "┏", "┷", "━", "┓",
@@ -239,6 +243,10 @@ static inline void
 mm_printf_subtitle (const char *format, ...)
 {
   va_list ap;
+
+  if (!MM_UI)
+    return;
+
   va_start (ap, format);
   mm_vprintf_box (format, ap, MM_VLINE,
                   "╰", "", "─", "╮",
@@ -250,20 +258,27 @@ mm_printf_subtitle (const char *format, ...)
 static inline void
 mm_print_cmd_end ()
 {
+  if (!MM_UI)
+    return;
+
   for (int i = 0; i < MM_VLINE; ++i)
-    printf ("─");
-  printf ("┤\n");
+    mm_printf ("─");
+  mm_printf ("┤\n");
 }
 
 static inline void
 mm_print_cmd (const char *cmd, bool arg)
 {
-  printf (arg ? "%*.*s " : MMCY ("%*.*s "), MM_VLINE - 1, MM_VLINE - 1, cmd);
+  if (!MM_UI)
+    return;
+
+  mm_printf (arg ? "%*.*s " : MMCY ("%*.*s "),
+             MM_VLINE - 1, MM_VLINE - 1, cmd);
   if (arg)
-    printf ("├ ");
+    mm_printf ("├ ");
   else
     {
-      printf ("│\n");
+      mm_printf ("│\n");
       mm_print_cmd_end ();
     }
 }
@@ -271,7 +286,10 @@ mm_print_cmd (const char *cmd, bool arg)
 static inline void
 mm_clear_screen ()
 {
-  printf ("\e[2J\e[H");
+  if (!MM_UI)
+    return;
+
+  mm_printf ("\e[2J\e[H");
 }
 
 #endif /* ! MM_PRINT_H */
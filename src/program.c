@@ -95,3 +95,14 @@ mm_program_previous (MMProgram *program)
 
   return mm_program_current (program);
 }
+
+/* Returns the sequence mm_program_next would move to.  */
+MMSequence *
+mm_program_peek (const MMProgram *program)
+{
+  if (program == NULL || program->current < -1
+      || program->current >= (program->nsequences - 1))
+    return NULL;
+
+  return program->sequences[program->current + 1];
+}
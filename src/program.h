@@ -28,5 +28,6 @@ MMSequence *mm_program_add (MMProgram *, MMSequence *);
 MMSequence *mm_program_current (const MMProgram *);
 MMSequence *mm_program_next (MMProgram *);
 MMSequence *mm_program_previous (MMProgram *);
+MMSequence *mm_program_peek (const MMProgram *);
 
 #endif /* ! MM_PROGRAM_H */
@@ -23,12 +23,18 @@
 #include "sequence.h"
 #include "print.h"
 
+/* Ports routes may name, negative for any, and whether one named
+   another.  */
+static int _nports = -1;
+static bool _bad_port = false;
+
 static bool load_sequence (MMProgram *, yaml_document_t *);
 const char *get_sequence_name (yaml_document_t *, yaml_node_t *);
 static void load_sequence_properties (MMSequence *, yaml_document_t *,
                                       yaml_node_t *);
 static void load_chords (MMSequence *, yaml_document_t *, yaml_node_t *);
 static void load_chord_properties (MMChord *, yaml_document_t *, yaml_node_t *);
+static bool load_route (MMRoute *, yaml_document_t *, yaml_node_t *);
 static bool node_to_string (yaml_node_t *, const char **);
 static bool node_to_int (yaml_node_t *, int *);
 static bool node_to_float (yaml_node_t *, double *);
@@ -36,8 +42,10 @@ static bool node_to_bool (yaml_node_t *, bool *);
 static yaml_node_t *get_node_by_key (yaml_document_t *, yaml_node_t *,
                                      const char *);
 
+/* Loads the program in FILENAME, whose routes may play on NPORTS ports
+   counting the main output, or on any port if NPORTS is negative.  */
 MMProgram *
-mm_program_factory (const char *filename)
+mm_program_factory (const char *filename, int nports)
 {
   MMProgram *program;
   FILE *file;
@@ -60,6 +68,8 @@ mm_program_factory (const char *filename)
   yaml_parser_set_input_file (&parser, file);
 
   program = mm_program_new ();
+  _nports = nports;
+  _bad_port = false;
 
   for (bool eof = false; !eof;) 
     {
@@ -80,6 +90,12 @@ mm_program_factory (const char *filename)
   yaml_parser_delete (&parser);
   fclose (file);
 
+  if (_bad_port)
+    {
+      mm_program_free (program);
+      return NULL;
+    }
+
   return program;
 }
 
@@ -129,6 +145,7 @@ load_sequence_properties (MMSequence *sequence, yaml_document_t *doc,
   bool tap;
   int prg;
   double bpm;
+  MMRoute route;
 
   if (node_to_int (get_node_by_key (doc, node, "loop"), &loop) && loop >= 0)
     mm_sequence_set_loop (sequence, (unsigned int) loop);
@@ -141,6 +158,12 @@ load_sequence_properties (MMSequence *sequence, yaml_document_t *doc,
 
   if (node_to_float (get_node_by_key (doc, node, "bpm"), &bpm) && bpm > 0.)
     mm_sequence_set_bpm (sequence, bpm);
+
+  if (load_route (&route, doc, node))
+    mm_sequence_set_route (sequence, &route);
+
+  if (load_route (&route, doc, get_node_by_key (doc, node, "bass")))
+    mm_sequence_set_bass_route (sequence, &route);
 }
 
 static void
@@ -215,6 +238,9 @@ load_chord_properties (MMChord *chord, yaml_document_t *doc, yaml_node_t *node)
   double delay;
   double broken;
   double duration;
+  double bpm;
+  double ramp;
+  MMRoute route;
 
   if (node_to_bool (get_node_by_key (doc, node, "lift"), &lift) && lift == true)
     mm_chord_set_lift (chord, lift);
@@ -231,10 +257,58 @@ load_chord_properties (MMChord *chord, yaml_document_t *doc, yaml_node_t *node)
   if (node_to_float (get_node_by_key (doc, node, "duration"), &duration))
     mm_chord_set_duration (chord, duration);
 
+  if (node_to_float (get_node_by_key (doc, node, "bpm"), &bpm) && bpm > 0.)
+    mm_chord_set_bpm (chord, bpm);
+
+  if (node_to_float (get_node_by_key (doc, node, "ramp"), &ramp))
+    mm_chord_set_ramp (chord, ramp);
+
+  if (load_route (&route, doc, node))
+    mm_chord_set_route (chord, &route);
+
+  if (load_route (&route, doc, get_node_by_key (doc, node, "bass")))
+    mm_chord_set_bass_route (chord, &route);
+
   load_chord_voicing (chord, doc, get_node_by_key (doc, node, "voice"), true);
   load_chord_voicing (chord, doc, get_node_by_key (doc, node, "double"), false);
 }
 
+/* Reads the "port" and "channel", 1-16, of NODE into ROUTE, leaving
+   those not given at -1.  Returns false if neither is.  */
+static bool
+load_route (MMRoute *route, yaml_document_t *doc, yaml_node_t *node)
+{
+  int port;
+  int channel;
+
+  route->port = -1;
+  route->channel = -1;
+
+  if (node == NULL || node->type != YAML_MAPPING_NODE)
+    return false;
+
+  if (node_to_int (get_node_by_key (doc, node, "port"), &port))
+    {
+      if (port >= 0 && (_nports < 0 || port < _nports))
+        route->port = port;
+      else
+        {
+          MMERR ("Invalid port " MMCY ("%d"), port);
+          _bad_port = true;
+        }
+    }
+
+  if (node_to_int (get_node_by_key (doc, node, "channel"), &channel))
+    {
+      if (channel >= 1 && channel <= 16)
+        route->channel = channel - 1;
+      else
+        MMERR ("Invalid channel " MMCY ("%d"), channel);
+    }
+
+  return route->port >= 0 || route->channel >= 0;
+}
+
 static bool
 node_to_string (yaml_node_t *node, const char **value)
 {
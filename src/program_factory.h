@@ -20,6 +20,6 @@
 
 #include "program.h"
 
-MMProgram *mm_program_factory (const char *);
+MMProgram *mm_program_factory (const char *, int);
 
 #endif /* ! MM_PROGRAM_FACTORY_H */
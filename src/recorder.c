@@ -0,0 +1,216 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "recorder.h"
+#include "ring.h"
+#include "timer.h"
+#include "print.h"
+
+/* The event loop only copies records into a lock-free ring, a background
+   thread drains it to disk every FLUSH_INTERVAL ms.  */
+#define RING_SIZE (MM_RECORDER_RECORD_SIZE * 4096)
+#define FLUSH_INTERVAL 50
+
+/* Event types by their code in recordings.  Codes are never reused,
+   new ones go last and bump MM_RECORDER_VERSION.  */
+static const MMInputEventType _types[] = {
+  MMIE_QUIT,
+  MMIE_KILLALL,
+  MMIE_NEXT_STEP,
+  MMIE_PREV_SEQ,
+  MMIE_NEXT_SEQ,
+  MMIE_TAP,
+  MMIE_TEMPO,
+  MMIE_EXPRESSION,
+  MMIE_TRANSPOSE,
+  MMIE_CHORD,
+  MMIE_CLOCK,
+  MMIE_START,
+  MMIE_STOP,
+  MMIE_NUDGE    /* Version 2.  */
+};
+
+/* Number of codes known to each version.  */
+static const unsigned int _ncodes[MM_RECORDER_VERSION + 1] = { 0, 13, 14 };
+
+struct _MMRecorder
+{
+  FILE *file;
+  MMRing *ring;
+  uint64_t start;
+  unsigned int dropped;
+  bool quit;
+  pthread_t thread;
+};
+
+static void
+put_le (unsigned char *dst, uint64_t value, int nbytes)
+{
+  for (int i = 0; i < nbytes; ++i)
+    dst[i] = (unsigned char) (value >> (8 * i));
+}
+
+static uint64_t
+get_le (const unsigned char *src, int nbytes)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < nbytes; ++i)
+    value |= (uint64_t) src[i] << (8 * i);
+  return value;
+}
+
+static void *
+mm_recorder_thread (void *data)
+{
+  MMRecorder *recorder = (MMRecorder *) data;
+  unsigned char buf[MM_RECORDER_RECORD_SIZE * 256];
+
+  for (;;)
+    {
+      bool quit = __atomic_load_n (&recorder->quit, __ATOMIC_ACQUIRE);
+      size_t nread;
+
+      while ((nread = mm_ring_read (recorder->ring, buf, sizeof (buf))) > 0)
+        fwrite (buf, 1, nread, recorder->file);
+      fflush (recorder->file);
+
+      if (quit)
+        break;
+
+      mm_sleep (FLUSH_INTERVAL);
+    }
+
+  return NULL;
+}
+
+MMRecorder *
+mm_recorder_new (const char *filename)
+{
+  MMRecorder *recorder;
+  unsigned char header[MM_RECORDER_HEADER_SIZE];
+  FILE *file;
+
+  assert (filename != NULL);
+
+  file = fopen (filename, "wb");
+  if (file == NULL)
+    {
+      MMERR ("Failed to open " MMCY ("%s"), filename);
+      return NULL;
+    }
+
+  recorder = calloc (1, sizeof (MMRecorder));
+  assert (recorder != NULL);
+  recorder->file = file;
+  recorder->ring = mm_ring_new (RING_SIZE);
+  recorder->start = mm_time_us ();
+
+  memcpy (header, MM_RECORDER_MAGIC, 4);
+  put_le (header + 4, MM_RECORDER_VERSION, 4);
+  put_le (header + 8, recorder->start, 8);
+  fwrite (header, 1, sizeof (header), file);
+
+  if (pthread_create (&recorder->thread, NULL, mm_recorder_thread,
+                      recorder) != 0)
+    {
+      MMERR ("Failed to start recorder thread");
+      mm_ring_free (recorder->ring);
+      fclose (file);
+      free (recorder);
+      return NULL;
+    }
+
+  return recorder;
+}
+
+void
+mm_recorder_free (MMRecorder *recorder)
+{
+  if (recorder == NULL)
+    return;
+
+  __atomic_store_n (&recorder->quit, true, __ATOMIC_RELEASE);
+  pthread_join (recorder->thread, NULL);
+
+  if (recorder->dropped > 0)
+    MMERR ("Recorder dropped " MMCY ("%u") " events", recorder->dropped);
+
+  fclose (recorder->file);
+  mm_ring_free (recorder->ring);
+  free (recorder);
+}
+
+void
+mm_recorder_record (MMRecorder *recorder, const MMInputEvent *event)
+{
+  unsigned char record[MM_RECORDER_RECORD_SIZE];
+  uint64_t value;
+  unsigned int code = 0;
+
+  if (recorder == NULL || event == NULL)
+    return;
+
+  while (code < _ncodes[MM_RECORDER_VERSION] && _types[code] != event->type)
+    ++code;
+
+  memcpy (&value, &event->value, sizeof (value));
+  put_le (record, event->time > recorder->start
+          ? event->time - recorder->start : 0, 8);
+  put_le (record + 8, code, 4);
+  put_le (record + 12, event->timestamp, 4);
+  put_le (record + 16, value, 8);
+
+  if (!mm_ring_write (recorder->ring, record, sizeof (record)))
+    ++recorder->dropped;
+}
+
+/* Returns the version in the recording HEADER.  */
+unsigned int
+mm_recorder_get_version (const unsigned char *header)
+{
+  return header != NULL ? (unsigned int) get_le (header + 4, 4) : 0;
+}
+
+/* Decodes RECORD of a recording of VERSION into EVENT, returning false
+   for an event code VERSION does not know.  */
+bool
+mm_recorder_decode (const unsigned char *record, unsigned int version,
+                    MMInputEvent *event)
+{
+  uint64_t value, code;
+
+  if (record == NULL || event == NULL || version == 0
+      || version > MM_RECORDER_VERSION)
+    return false;
+
+  event->time = get_le (record, 8);
+  code = get_le (record + 8, 4);
+  event->timestamp = (unsigned int) get_le (record + 12, 4);
+  value = get_le (record + 16, 8);
+  memcpy (&event->value, &value, sizeof (value));
+
+  if (code >= _ncodes[version])
+    return false;
+  event->type = _types[code];
+  return true;
+}
@@ -0,0 +1,42 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef MM_RECORDER_H
+#define MM_RECORDER_H 1
+
+#include <stdbool.h>
+
+#include "input.h"
+
+/* A recording is a 16 byte header (MAGIC, a 32 bit version and the 64 bit
+   mm_time_us () start time) followed by RECORD_SIZE byte records of a 64
+   bit time in us since the start, 32 bit event code, 32 bit backend
+   timestamp and the 64 bit IEEE 754 value.  All fields are little-endian.
+   Event codes are fixed for each VERSION, not taken from the enum.  */
+#define MM_RECORDER_MAGIC "MMIR"
+#define MM_RECORDER_VERSION 2
+#define MM_RECORDER_HEADER_SIZE 16
+#define MM_RECORDER_RECORD_SIZE 24
+
+MMRecorder *mm_recorder_new (const char *);
+void mm_recorder_free (MMRecorder *);
+void mm_recorder_record (MMRecorder *, const MMInputEvent *);
+unsigned int mm_recorder_get_version (const unsigned char *);
+bool mm_recorder_decode (const unsigned char *, unsigned int,
+                         MMInputEvent *);
+
+#endif /* ! MM_RECORDER_H */
@@ -0,0 +1,135 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "render.h"
+#include "app.h"
+#include "input_script.h"
+#include "output_smf.h"
+#include "program_factory.h"
+#include "timer.h"
+#include "print.h"
+
+/* Renders the program in FILE to the Standard MIDI File PATH in virtual
+   time.  Input events come from SCRIPT if given, otherwise every chord is
+   stepped through automatically.  */
+bool
+mm_render (const char *file, const char *script, const char *path)
+{
+  MMInput *input = NULL;
+  MMOutput *output;
+  MMProgram *program;
+  MMApp *app;
+  MMOutputDevice device = { mm_output_smf_backend->name, 0, "" };
+
+  /* Every port ends up in the one file.  */
+  program = mm_program_factory (file, -1);
+  if (program == NULL)
+    return false;
+
+  if (script != NULL)
+    {
+      MMInputDevice script_device = { mm_input_script_backend->name, 0, "" };
+      strncpy (script_device.name, script, sizeof (script_device.name) - 1);
+      input = mm_input_new (&script_device);
+      if (input == NULL)
+        {
+          mm_program_free (program);
+          return false;
+        }
+    }
+
+  strncpy (device.name, path, sizeof (device.name) - 1);
+  output = mm_output_new (&device);
+  if (output == NULL)
+    {
+      mm_input_free (input);
+      mm_program_free (program);
+      return false;
+    }
+
+  app = mm_app_new (input, mm_player_new (output));
+  mm_app_set_autostep (app, input == NULL);
+  mm_app_run (app, program);
+
+  /* The file is written once the output is freed.  */
+  mm_app_free (app);
+  mm_program_free (program);
+
+  return true;
+}
+
+/* Renders NFILES programs, one child process per file and at most one per
+   core.  With more than one file PATH names a directory, which gets one
+   "<name>.mid" per program.  Returns the number of failed renders.  */
+int
+mm_render_all (char *const *files, int nfiles, const char *script,
+               const char *path)
+{
+  long ncores = sysconf (_SC_NPROCESSORS_ONLN);
+  int running = 0;
+  int failed = 0;
+  int status;
+
+  mm_time_set_virtual (true);
+
+  if (nfiles == 1)
+    return mm_render (files[0], script, path) ? 0 : 1;
+
+  for (int i = 0; i < nfiles; ++i)
+    {
+      char out[PATH_MAX];
+      const char *name = strrchr (files[i], '/');
+      const char *ext;
+      pid_t pid;
+
+      name = (name != NULL) ? name + 1 : files[i];
+      ext = strrchr (name, '.');
+      snprintf (out, sizeof (out), "%s/%.*s.mid", path,
+                (int) (ext != NULL && ext != name
+                       ? (size_t) (ext - name) : strlen (name)),
+                name);
+
+      for (; running > 0 && running >= ncores; --running)
+        if (wait (&status) < 0 || !WIFEXITED (status)
+            || WEXITSTATUS (status) != EXIT_SUCCESS)
+          ++failed;
+
+      pid = fork ();
+      if (pid == 0)
+        _exit (mm_render (files[i], script, out)
+               ? EXIT_SUCCESS : EXIT_FAILURE);
+      else if (pid > 0)
+        ++running;
+      else if (!mm_render (files[i], script, out))
+        ++failed;
+    }
+
+  for (; running > 0; --running)
+    if (wait (&status) < 0 || !WIFEXITED (status)
+        || WEXITSTATUS (status) != EXIT_SUCCESS)
+      ++failed;
+
+  return failed;
+}
@@ -0,0 +1,123 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "ring.h"
+
+/* Lock-free byte ring for exactly one writer and one reader thread.  HEAD
+   and TAIL only ever grow; the writer owns HEAD, the reader owns TAIL and
+   each publishes its own with release semantics.  */
+
+struct _MMRing
+{
+  unsigned char *data;
+  size_t size;
+  size_t head;
+  size_t tail;
+};
+
+MMRing *
+mm_ring_new (size_t size)
+{
+  MMRing *ring;
+  size_t capacity = 1;
+
+  while (capacity < size)
+    capacity <<= 1;
+
+  ring = calloc (1, sizeof (MMRing));
+  assert (ring != NULL);
+  ring->data = malloc (capacity);
+  assert (ring->data != NULL);
+  ring->size = capacity;
+
+  return ring;
+}
+
+void
+mm_ring_free (MMRing *ring)
+{
+  if (ring != NULL)
+    {
+      free (ring->data);
+      free (ring);
+    }
+}
+
+bool
+mm_ring_write (MMRing *ring, const void *data, size_t length)
+{
+  size_t head, tail, offset, chunk;
+
+  if (ring == NULL || data == NULL)
+    return false;
+
+  head = ring->head;
+  tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+  if (ring->size - (head - tail) < length)
+    return false;
+
+  offset = head & (ring->size - 1);
+  chunk = ring->size - offset;
+  if (chunk > length)
+    chunk = length;
+
+  memcpy (ring->data + offset, data, chunk);
+  memcpy (ring->data, (const unsigned char *) data + chunk, length - chunk);
+
+  __atomic_store_n (&ring->head, head + length, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+size_t
+mm_ring_read (MMRing *ring, void *data, size_t length)
+{
+  size_t head, tail, offset, chunk;
+
+  if (ring == NULL || data == NULL)
+    return 0;
+
+  tail = ring->tail;
+  head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+  if (length > head - tail)
+    length = head - tail;
+
+  offset = tail & (ring->size - 1);
+  chunk = ring->size - offset;
+  if (chunk > length)
+    chunk = length;
+
+  memcpy (data, ring->data + offset, chunk);
+  memcpy ((unsigned char *) data + chunk, ring->data, length - chunk);
+
+  __atomic_store_n (&ring->tail, tail + length, __ATOMIC_RELEASE);
+
+  return length;
+}
+
+size_t
+mm_ring_get_used (const MMRing *ring)
+{
+  if (ring == NULL)
+    return 0;
+  return __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)
+    - __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,32 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef MM_RING_H
+#define MM_RING_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct _MMRing MMRing;
+
+MMRing *mm_ring_new (size_t);
+void mm_ring_free (MMRing *);
+bool mm_ring_write (MMRing *, const void *, size_t);
+size_t mm_ring_read (MMRing *, void *, size_t);
+size_t mm_ring_get_used (const MMRing *);
+
+#endif /* ! MM_RING_H */
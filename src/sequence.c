@@ -20,6 +20,7 @@
 #include <string.h>
 
 #include "sequence.h"
+#include "tempo.h"
 #include "print.h"
 
 #define MAX_NUM_CHORDS 64
@@ -28,14 +29,20 @@ struct _MMSequence
 {
   char *name;
   MMChord *chords[MAX_NUM_CHORDS];
+  MMTempoRamp *ramps[MAX_NUM_CHORDS];
   int nchords;
   int current;
   unsigned int loop;
   bool tap;
   int midiprg;
   double bpm;
+  MMRoute route;
+  MMRoute bass;
 };
 
+static const MMRoute default_route = { 0, 0 };
+static const MMRoute no_route = { -1, -1 };
+
 MMSequence *
 mm_sequence_new (const char *name)
 {
@@ -50,6 +57,8 @@ mm_sequence_new (const char *name)
   sequence->tap = false;
   sequence->midiprg = -1;
   sequence->bpm = -1.;
+  sequence->route = default_route;
+  sequence->bass = no_route;
   return sequence;
 }
 
@@ -61,7 +70,10 @@ mm_sequence_free (MMSequence *sequence)
       if (sequence->name != NULL)
         free (sequence->name);
       for (int i = 0; i < sequence->nchords; ++i)
-        mm_chord_free (sequence->chords[i]);
+        {
+          mm_chord_free (sequence->chords[i]);
+          mm_tempo_ramp_free (sequence->ramps[i]);
+        }
       free (sequence);
     }
 }
@@ -126,6 +138,99 @@ mm_sequence_set_bpm (MMSequence *sequence, double bpm)
     sequence->bpm = bpm;
 }
 
+/* Returns where the notes and program change of SEQUENCE go, unless a
+   chord says otherwise.  */
+const MMRoute *
+mm_sequence_get_route (const MMSequence *sequence)
+{
+  return (sequence != NULL) ? &sequence->route : &default_route;
+}
+
+/* Chords added after this take the fields they leave at -1 from
+   ROUTE.  */
+void
+mm_sequence_set_route (MMSequence *sequence, const MMRoute *route)
+{
+  if (sequence != NULL && route != NULL)
+    {
+      if (route->port >= 0)
+        sequence->route.port = route->port;
+      if (route->channel >= 0)
+        sequence->route.channel = route->channel;
+    }
+}
+
+const MMRoute *
+mm_sequence_get_bass_route (const MMSequence *sequence)
+{
+  return (sequence != NULL) ? &sequence->bass : &no_route;
+}
+
+void
+mm_sequence_set_bass_route (MMSequence *sequence, const MMRoute *route)
+{
+  if (sequence != NULL && route != NULL)
+    sequence->bass = *route;
+}
+
+/* Fills the fields of ROUTE left at -1 from DEFAULTS.  */
+static void
+fill_route (MMRoute *route, const MMRoute *defaults)
+{
+  if (route->port < 0)
+    route->port = defaults->port;
+  if (route->channel < 0)
+    route->channel = defaults->channel;
+}
+
+/* Completes the routes of CHORD from those of SEQUENCE, so the player
+   only has to look at the chord.  A bass layer set on either gets what
+   it leaves open from the route of the chord.  */
+static void
+inherit_routes (const MMSequence *sequence, MMChord *chord)
+{
+  MMRoute route = *mm_chord_get_route (chord);
+  MMRoute bass = *mm_chord_get_bass_route (chord);
+
+  fill_route (&route, &sequence->route);
+  mm_chord_set_route (chord, &route);
+
+  fill_route (&bass, &sequence->bass);
+  if (bass.port >= 0 || bass.channel >= 0)
+    {
+      fill_route (&bass, &route);
+      mm_chord_set_bass_route (chord, &bass);
+    }
+}
+
+/* The tempo map is built from the tempo written in the sequence, so a
+   ramp is tabled from the bpm of the last chord before it that has one,
+   or else that of the sequence.  The player starts it from whatever
+   tempo is playing when the chord comes.  */
+static MMTempoRamp *
+make_ramp (const MMSequence *sequence, const MMChord *chord)
+{
+  double from = sequence->bpm;
+
+  if (mm_chord_get_bpm (chord) <= 0. || mm_chord_get_ramp (chord) <= 0.)
+    return NULL;
+
+  for (int i = sequence->nchords - 1; i >= 0; --i)
+    {
+      if (mm_chord_get_bpm (sequence->chords[i]) > 0.)
+        {
+          from = mm_chord_get_bpm (sequence->chords[i]);
+          break;
+        }
+    }
+
+  if (from <= 0.)
+    from = mm_chord_get_bpm (chord);
+
+  return mm_tempo_ramp_new (from, mm_chord_get_bpm (chord),
+                            mm_chord_get_ramp (chord));
+}
+
 MMChord *
 mm_sequence_add (MMSequence *sequence, MMChord *chord)
 {
@@ -138,11 +243,22 @@ mm_sequence_add (MMSequence *sequence, MMChord *chord)
       return NULL;
     }
 
+  inherit_routes (sequence, chord);
+  sequence->ramps[sequence->nchords] = make_ramp (sequence, chord);
   sequence->chords[sequence->nchords++] = chord;
 
   return chord;
 }
 
+/* Returns the tempo ramp into the chord at POSITION, if it has one.  */
+const MMTempoRamp *
+mm_sequence_get_ramp (const MMSequence *sequence, int position)
+{
+  if (sequence == NULL || position < 0 || position >= sequence->nchords)
+    return NULL;
+  return sequence->ramps[position];
+}
+
 MMChord *
 mm_sequence_next (MMSequence *sequence)
 {
@@ -161,6 +277,54 @@ mm_sequence_next (MMSequence *sequence)
   return sequence->chords[sequence->current];
 }
 
+int
+mm_sequence_get_length (const MMSequence *sequence)
+{
+  return (sequence != NULL) ? sequence->nchords : 0;
+}
+
+/* Returns the index of the current chord, -1 before the first.  */
+int
+mm_sequence_get_position (const MMSequence *sequence)
+{
+  return (sequence != NULL) ? sequence->current : -1;
+}
+
+MMChord *
+mm_sequence_get_chord (const MMSequence *sequence, int position)
+{
+  if (sequence == NULL || position < 0 || position >= sequence->nchords)
+    return NULL;
+  return sequence->chords[position];
+}
+
+/* Returns the beat the chord at POSITION starts on, counting chords
+   without a duration as one beat.  */
+double
+mm_sequence_get_beat (const MMSequence *sequence, int position)
+{
+  double beat = 0.;
+
+  if (sequence == NULL)
+    return 0.;
+
+  for (int i = 0; i < position && i < sequence->nchords; ++i)
+    {
+      double duration = mm_chord_get_duration (sequence->chords[i]);
+      beat += duration > 0. ? duration : 1.;
+    }
+
+  return beat;
+}
+
+/* Makes POSITION current without playing it, -1 resets.  */
+void
+mm_sequence_seek (MMSequence *sequence, int position)
+{
+  if (sequence != NULL && position >= -1 && position < sequence->nchords)
+    sequence->current = position;
+}
+
 void
 mm_sequence_reset (MMSequence *sequence)
 {
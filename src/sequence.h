@@ -20,6 +20,7 @@
 
 #include <stdbool.h>
 #include "chord.h"
+#include "tempo.h"
 
 typedef struct _MMSequence MMSequence;
 
@@ -34,8 +35,18 @@ int mm_sequence_get_midiprg (const MMSequence *);
 void mm_sequence_set_midiprg (MMSequence *, int);
 double mm_sequence_get_bpm (const MMSequence *);
 void mm_sequence_set_bpm (MMSequence *, double);
+const MMRoute *mm_sequence_get_route (const MMSequence *);
+void mm_sequence_set_route (MMSequence *, const MMRoute *);
+const MMRoute *mm_sequence_get_bass_route (const MMSequence *);
+void mm_sequence_set_bass_route (MMSequence *, const MMRoute *);
 MMChord *mm_sequence_add (MMSequence *, MMChord *);
 MMChord *mm_sequence_next (MMSequence *);
+int mm_sequence_get_length (const MMSequence *);
+int mm_sequence_get_position (const MMSequence *);
+MMChord *mm_sequence_get_chord (const MMSequence *, int);
+double mm_sequence_get_beat (const MMSequence *, int);
+const MMTempoRamp *mm_sequence_get_ramp (const MMSequence *, int);
+void mm_sequence_seek (MMSequence *, int);
 void mm_sequence_reset (MMSequence *);
 bool mm_sequence_is_reset (const MMSequence *);
 
@@ -0,0 +1,395 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "smf_import.h"
+#include "chord.h"
+#include "output.h"
+#include "print.h"
+
+/* Reads a Standard MIDI File straight from a memory map, merging its
+   tracks on the fly, and writes the chords in it as a program in YAML.
+   Note ons within a 32nd note of each other form a group, and a group of
+   at least two notes changing the sounding chord starts a new chord.
+   Markers start new sequences, as does every MAX_NUM_CHORDS chords.  */
+#define MAX_NUM_TRACKS 256
+#define MAX_NUM_CHORDS 64
+#define DRUM_CHANNEL 9
+
+typedef struct
+{
+  const unsigned char *pos;
+  const unsigned char *end;
+  uint64_t tick;
+  int running;
+  bool done;
+} MMTrack;
+
+typedef struct
+{
+  FILE *out;
+  unsigned int ppq;
+  unsigned int tempo;
+  unsigned char held[128];
+  bool grouped[128];
+  bool in_group;
+  int group_size;
+  uint64_t group_tick;
+  uint64_t last_tick;
+  char chord[32];
+  int octave;
+  uint64_t chord_tick;
+  unsigned int chord_tempo;
+  int nchords;
+  int nsequences;
+  char marker[64];
+} MMImport;
+
+static bool
+read_vlq (MMTrack *track, uint32_t *value)
+{
+  *value = 0;
+  for (int i = 0; i < 4; ++i)
+    {
+      if (track->pos >= track->end)
+        return false;
+      *value = (*value << 7) | (*track->pos & 0x7F);
+      if ((*track->pos++ & 0x80) == 0)
+        return true;
+    }
+  return false;
+}
+
+static void
+next_delta (MMTrack *track)
+{
+  uint32_t delta;
+  if (track->pos >= track->end || !read_vlq (track, &delta))
+    track->done = true;
+  else
+    track->tick += delta;
+}
+
+static void
+write_string (FILE *out, const char *str)
+{
+  fputc ('"', out);
+  for (const char *c = str; *c != '\0'; ++c)
+    {
+      if (*c == '"' || *c == '\\')
+        fputc ('\\', out);
+      fputc ((*c >= 0x20 && *c < 0x7F) ? *c : '?', out);
+    }
+  fputc ('"', out);
+}
+
+static void
+flush_chord (MMImport *import, uint64_t end)
+{
+  double duration;
+
+  if (import->chord[0] == '\0')
+    return;
+
+  if (import->marker[0] != '\0' || import->nchords == MAX_NUM_CHORDS
+      || import->nsequences == 0)
+    {
+      char name[64];
+      if (import->marker[0] != '\0')
+        snprintf (name, sizeof (name), "%s", import->marker);
+      else
+        snprintf (name, sizeof (name), "Part %d", import->nsequences + 1);
+      fprintf (import->out, "---\nname: ");
+      write_string (import->out, name);
+      fprintf (import->out, "\nbpm: %g\nchords:\n",
+               round (60000000000. / import->chord_tempo) / 1000.);
+      import->marker[0] = '\0';
+      import->nchords = 0;
+      ++import->nsequences;
+    }
+
+  duration = round ((end - import->chord_tick) * 1000. / import->ppq) / 1000.;
+  fprintf (import->out, "  - name: %s\n    duration: %g\n",
+           import->chord, duration);
+  if (import->octave != 0)
+    fprintf (import->out, "    octave: %d\n", import->octave);
+
+  import->chord[0] = '\0';
+  ++import->nchords;
+}
+
+static void
+close_group (MMImport *import)
+{
+  int notes[128];
+  int nnotes = 0;
+  char name[32];
+
+  import->in_group = false;
+
+  for (int n = 0; n < 128; ++n)
+    {
+      if (import->held[n] > 0 || import->grouped[n])
+        notes[nnotes++] = n;
+      import->grouped[n] = false;
+    }
+
+  /* Single notes are melody.  */
+  if (import->group_size < 2
+      || mm_chord_name_notes (notes, nnotes, name, sizeof (name)) < 0
+      || strcmp (name, import->chord) == 0)
+    return;
+
+  flush_chord (import, import->group_tick);
+  strcpy (import->chord, name);
+  import->chord_tick = import->group_tick;
+  import->chord_tempo = import->tempo;
+
+  /* Keep the register of the lowest note.  */
+  import->octave = 0;
+  {
+    MMChord *chord = mm_chord_new (name);
+    int cnotes[24];
+    if (chord != NULL && mm_chord_get_notes (chord, cnotes, 24) > 0)
+      import->octave = (int) floor ((notes[0] - cnotes[0]) / 12. + .5);
+    mm_chord_free (chord);
+  }
+}
+
+static void
+handle_event (MMImport *import, MMTrack *track)
+{
+  int status;
+
+  if (import->in_group
+      && track->tick > import->group_tick + import->ppq / 8)
+    close_group (import);
+
+  status = *track->pos;
+  if (status & 0x80)
+    {
+      ++track->pos;
+      if (status < 0xF0)
+        track->running = status;
+    }
+  else if (track->running != 0)
+    status = track->running;
+  else
+    {
+      track->done = true;
+      return;
+    }
+
+  if (status == 0xFF || status == 0xF0 || status == 0xF7)
+    {
+      int type = 0;
+      uint32_t length;
+
+      if (status == 0xFF)
+        {
+          if (track->pos >= track->end)
+            {
+              track->done = true;
+              return;
+            }
+          type = *track->pos++;
+        }
+
+      if (!read_vlq (track, &length)
+          || length > (size_t) (track->end - track->pos))
+        {
+          track->done = true;
+          return;
+        }
+
+      if (type == 0x51 && length == 3)
+        import->tempo = (track->pos[0] << 16) | (track->pos[1] << 8)
+          | track->pos[2];
+      else if (type == 0x06 && length > 0)
+        {
+          flush_chord (import, track->tick);
+          snprintf (import->marker, sizeof (import->marker), "%.*s",
+                    (int) length, (const char *) track->pos);
+        }
+
+      track->pos += length;
+      if (type == 0x2F)
+        track->done = true;
+    }
+  else
+    {
+      int length = mm_message_length (status) - 1;
+      int note, velocity;
+
+      if (track->end - track->pos < length)
+        {
+          track->done = true;
+          return;
+        }
+
+      note = track->pos[0] & 0x7F;
+      velocity = (length > 1) ? track->pos[1] & 0x7F : 0;
+      track->pos += length;
+
+      if ((status & 0x0F) == DRUM_CHANNEL)
+        ;
+      else if ((status & 0xF0) == 0x90 && velocity > 0)
+        {
+          if (!import->in_group)
+            {
+              import->in_group = true;
+              import->group_size = 0;
+              import->group_tick = track->tick;
+            }
+          import->held[note] += (import->held[note] < 0xFF) ? 1 : 0;
+          import->grouped[note] = true;
+          ++import->group_size;
+        }
+      else if ((status & 0xF0) == 0x80 || (status & 0xF0) == 0x90)
+        {
+          if (import->held[note] > 0)
+            --import->held[note];
+          import->last_tick = track->tick;
+        }
+      else if ((status & 0xF0) == 0xB0 && (note == 0x78 || note == 0x7B))
+        {
+          /* All sound or all notes off.  */
+          memset (import->held, 0, sizeof (import->held));
+          import->last_tick = track->tick;
+        }
+    }
+
+  if (!track->done)
+    next_delta (track);
+}
+
+static bool
+import_smf (const unsigned char *data, size_t size, FILE *out)
+{
+  MMTrack tracks[MAX_NUM_TRACKS];
+  MMImport *import;
+  const unsigned char *pos;
+  int format, ntracks, division;
+
+  if (size < 14 || memcmp (data, "MThd", 4) != 0)
+    return false;
+
+  format = (data[8] << 8) | data[9];
+  ntracks = (data[10] << 8) | data[11];
+  division = (data[12] << 8) | data[13];
+  if (format > 2 || ntracks > MAX_NUM_TRACKS || division & 0x8000
+      || division == 0)
+    return false;
+
+  pos = data + 8 + ((data[4] << 24) | (data[5] << 16) | (data[6] << 8)
+                    | data[7]);
+  for (int i = 0; i < ntracks; ++i)
+    {
+      size_t length;
+
+      if (pos + 8 > data + size || memcmp (pos, "MTrk", 4) != 0)
+        {
+          ntracks = i;
+          break;
+        }
+      length = (pos[4] << 24) | (pos[5] << 16) | (pos[6] << 8) | pos[7];
+      pos += 8;
+      tracks[i].pos = pos;
+      tracks[i].end = (length < (size_t) (data + size - pos))
+        ? pos + length : data + size;
+      tracks[i].tick = 0;
+      tracks[i].running = 0;
+      tracks[i].done = false;
+      next_delta (&tracks[i]);
+      pos = tracks[i].end;
+    }
+
+  import = calloc (1, sizeof (MMImport));
+  if (import == NULL)
+    return false;
+  import->out = out;
+  import->ppq = division;
+  import->tempo = 500000;
+
+  /* Format 2 tracks are independent songs, but play them back to back
+     like the rest.  */
+  for (;;)
+    {
+      MMTrack *next = NULL;
+      for (int i = 0; i < ntracks; ++i)
+        if (!tracks[i].done && (next == NULL || tracks[i].tick < next->tick))
+          next = &tracks[i];
+      if (next == NULL)
+        break;
+      handle_event (import, next);
+    }
+
+  if (import->in_group)
+    close_group (import);
+  flush_chord (import, import->last_tick > import->chord_tick
+               ? import->last_tick : import->chord_tick);
+
+  free (import);
+  return true;
+}
+
+/* Writes the chords of the Standard MIDI File PATH to OUT as a program in
+   YAML, ready for mm_program_factory.  */
+bool
+mm_smf_import (const char *path, FILE *out)
+{
+  struct stat st;
+  void *data;
+  int fd;
+  bool imported;
+
+  if (path == NULL || out == NULL)
+    return false;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0 || fstat (fd, &st) != 0 || st.st_size == 0)
+    {
+      MMERR ("Failed to open " MMCY ("%s"), path);
+      if (fd >= 0)
+        close (fd);
+      return false;
+    }
+
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    {
+      MMERR ("Failed to map " MMCY ("%s"), path);
+      return false;
+    }
+  madvise (data, st.st_size, MADV_SEQUENTIAL);
+
+  imported = import_smf ((const unsigned char *) data, st.st_size, out);
+  if (!imported)
+    MMERR ("Unsupported MIDI file " MMCY ("%s"), path);
+
+  munmap (data, st.st_size);
+  return imported;
+}
@@ -0,0 +1,196 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+/* Values are counted in log-linear buckets: exact below 2^SUB_BITS, then
+   2^SUB_BITS buckets per power of two, which keeps the relative error of
+   any percentile below 1 / 2^SUB_BITS (~3%) at a fixed, small size.  */
+#define SUB_BITS 5
+#define SUB_COUNT (1 << SUB_BITS)
+#define NUM_BUCKETS ((32 - SUB_BITS + 1) * SUB_COUNT)
+
+struct _MMStats
+{
+  char *name;
+  unsigned int count;
+  unsigned int min;
+  unsigned int max;
+  double sum;
+  unsigned int buckets[NUM_BUCKETS];
+};
+
+static inline int
+bucket_index (unsigned int value)
+{
+  int exp;
+
+  if (value < SUB_COUNT)
+    return (int) value;
+
+  exp = 31 - __builtin_clz (value);
+  return ((exp - SUB_BITS + 1) * SUB_COUNT)
+    + (int) ((value >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+static inline unsigned int
+bucket_value (int index)
+{
+  int exp;
+
+  if (index < SUB_COUNT)
+    return (unsigned int) index;
+
+  exp = (index / SUB_COUNT) + SUB_BITS - 1;
+  return (unsigned int) ((SUB_COUNT + (index % SUB_COUNT))
+                         << (exp - SUB_BITS));
+}
+
+MMStats *
+mm_stats_new (const char *name)
+{
+  MMStats *stats;
+  assert (name != NULL);
+  stats = calloc (1, sizeof (MMStats));
+  assert (stats != NULL);
+  stats->name = strndup (name, 32);
+  assert (stats->name != NULL);
+  mm_stats_reset (stats);
+  return stats;
+}
+
+void
+mm_stats_free (MMStats *stats)
+{
+  if (stats != NULL)
+    {
+      if (stats->name != NULL)
+        free (stats->name);
+      free (stats);
+    }
+}
+
+const char *
+mm_stats_get_name (const MMStats *stats)
+{
+  return (stats != NULL) ? stats->name : NULL;
+}
+
+void
+mm_stats_record (MMStats *stats, unsigned int value)
+{
+  if (stats == NULL)
+    return;
+
+  ++stats->buckets[bucket_index (value)];
+  ++stats->count;
+  stats->sum += value;
+  if (value < stats->min)
+    stats->min = value;
+  if (value > stats->max)
+    stats->max = value;
+}
+
+void
+mm_stats_reset (MMStats *stats)
+{
+  if (stats == NULL)
+    return;
+
+  memset (stats->buckets, 0, sizeof (stats->buckets));
+  stats->count = 0;
+  stats->sum = 0.;
+  stats->min = ~0U;
+  stats->max = 0;
+}
+
+unsigned int
+mm_stats_get_count (const MMStats *stats)
+{
+  return (stats != NULL) ? stats->count : 0;
+}
+
+unsigned int
+mm_stats_get_min (const MMStats *stats)
+{
+  return (stats != NULL && stats->count > 0) ? stats->min : 0;
+}
+
+unsigned int
+mm_stats_get_max (const MMStats *stats)
+{
+  return (stats != NULL) ? stats->max : 0;
+}
+
+double
+mm_stats_get_mean (const MMStats *stats)
+{
+  if (stats == NULL || stats->count == 0)
+    return 0.;
+  return stats->sum / stats->count;
+}
+
+unsigned int
+mm_stats_get_percentile (const MMStats *stats, double percentile)
+{
+  unsigned int rank, seen = 0;
+
+  if (stats == NULL || stats->count == 0)
+    return 0;
+
+  rank = (unsigned int) ((percentile / 100.) * stats->count + .5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > stats->count)
+    rank = stats->count;
+
+  for (int i = 0; i < NUM_BUCKETS; ++i)
+    {
+      seen += stats->buckets[i];
+      if (seen >= rank)
+        {
+          unsigned int value = bucket_value (i);
+          /* The bucket bound may fall outside what was actually seen.  */
+          if (value < stats->min)
+            return stats->min;
+          return (value > stats->max) ? stats->max : value;
+        }
+    }
+
+  return stats->max;
+}
+
+int
+mm_stats_format (const MMStats *stats, char *buf, size_t size)
+{
+  if (stats == NULL || buf == NULL)
+    return -1;
+
+  return snprintf (buf, size, "%-16s count=%u min=%u p50=%u p90=%u "
+                   "p99=%u p99.9=%u max=%u mean=%.1f",
+                   stats->name, stats->count, mm_stats_get_min (stats),
+                   mm_stats_get_percentile (stats, 50.),
+                   mm_stats_get_percentile (stats, 90.),
+                   mm_stats_get_percentile (stats, 99.),
+                   mm_stats_get_percentile (stats, 99.9),
+                   stats->max, mm_stats_get_mean (stats));
+}
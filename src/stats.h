@@ -0,0 +1,37 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef MM_STATS_H
+#define MM_STATS_H 1
+
+#include <stddef.h>
+
+typedef struct _MMStats MMStats;
+
+MMStats *mm_stats_new (const char *);
+void mm_stats_free (MMStats *);
+const char *mm_stats_get_name (const MMStats *);
+void mm_stats_record (MMStats *, unsigned int);
+void mm_stats_reset (MMStats *);
+unsigned int mm_stats_get_count (const MMStats *);
+unsigned int mm_stats_get_min (const MMStats *);
+unsigned int mm_stats_get_max (const MMStats *);
+double mm_stats_get_mean (const MMStats *);
+unsigned int mm_stats_get_percentile (const MMStats *, double);
+int mm_stats_format (const MMStats *, char *, size_t);
+
+#endif /* ! MM_STATS_H */
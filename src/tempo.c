@@ -0,0 +1,139 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "tempo.h"
+#include "print.h"
+
+#define MAX_RAMP_BEATS 256.
+
+/* A ramp changes the tempo linearly per beat, so beat X of N is at
+   bpm(X) = FROM + (TO - FROM) * X / N.  The time of each clock pulse is
+   the integral of 60000 / bpm(X) and is tabled when the ramp is made.
+   Started from another tempo than FROM, the times are worked out as the
+   pulses are looked up instead, with no need for a table of their own.  */
+struct _MMTempoRamp
+{
+  double from;
+  double to;
+  unsigned int npulses;
+  double times[];
+};
+
+/* Returns the time of PULSE of NPULSES in ms, ramping FROM to TO.  */
+static double
+pulse_time (double from, double to, unsigned int npulses,
+            unsigned int pulse)
+{
+  double slope = (to - from) / npulses; /* per pulse.  */
+
+  if (fabs (slope) < 1e-9)
+    return pulse * 2500. / from;
+  return 2500. / slope * log ((from + slope * pulse) / from);
+}
+
+MMTempoRamp *
+mm_tempo_ramp_new (double from, double to, double beats)
+{
+  MMTempoRamp *ramp;
+  unsigned int npulses;
+
+  if (from <= 0. || to <= 0. || beats <= 0.)
+    return NULL;
+
+  if (beats > MAX_RAMP_BEATS)
+    {
+      MMERR ("Ramp of " MMCY ("%g") " beats cut to " MMCY ("%g"),
+             beats, MAX_RAMP_BEATS);
+      beats = MAX_RAMP_BEATS;
+    }
+
+  npulses = (unsigned int) lround (beats * 24.);
+  if (npulses == 0)
+    return NULL;
+
+  ramp = malloc (sizeof (MMTempoRamp) + sizeof (double) * (npulses + 1));
+  assert (ramp != NULL);
+  ramp->from = from;
+  ramp->to = to;
+  ramp->npulses = npulses;
+
+  for (unsigned int i = 0; i <= npulses; ++i)
+    ramp->times[i] = pulse_time (from, to, npulses, i);
+
+  return ramp;
+}
+
+void
+mm_tempo_ramp_free (MMTempoRamp *ramp)
+{
+  if (ramp != NULL)
+    free (ramp);
+}
+
+double
+mm_tempo_ramp_get_from (const MMTempoRamp *ramp)
+{
+  return (ramp != NULL) ? ramp->from : -1.;
+}
+
+double
+mm_tempo_ramp_get_to (const MMTempoRamp *ramp)
+{
+  return (ramp != NULL) ? ramp->to : -1.;
+}
+
+/* Returns the number of pulses in RAMP.  */
+unsigned int
+mm_tempo_ramp_get_length (const MMTempoRamp *ramp)
+{
+  return (ramp != NULL) ? ramp->npulses : 0;
+}
+
+/* Returns the time of PULSE in ms from the start of RAMP, started from
+   FROM bpm.  */
+double
+mm_tempo_ramp_get_time (const MMTempoRamp *ramp, double from,
+                        unsigned int pulse)
+{
+  if (ramp == NULL)
+    return 0.;
+  if (pulse > ramp->npulses)
+    pulse = ramp->npulses;
+  if (from == ramp->from || from <= 0.)
+    return ramp->times[pulse];
+  return pulse_time (from, ramp->to, ramp->npulses, pulse);
+}
+
+/* Returns the tempo between PULSE and the one before it, the ramp being
+   started from FROM bpm.  */
+double
+mm_tempo_ramp_get_bpm (const MMTempoRamp *ramp, double from,
+                       unsigned int pulse)
+{
+  if (ramp == NULL)
+    return -1.;
+  if (pulse == 0)
+    return from > 0. ? from : ramp->from;
+  if (pulse > ramp->npulses)
+    return ramp->to;
+  return 2500. / (mm_tempo_ramp_get_time (ramp, from, pulse)
+                  - mm_tempo_ramp_get_time (ramp, from, pulse - 1));
+}
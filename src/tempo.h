@@ -0,0 +1,31 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef MM_TEMPO_H
+#define MM_TEMPO_H 1
+
+typedef struct _MMTempoRamp MMTempoRamp;
+
+MMTempoRamp *mm_tempo_ramp_new (double, double, double);
+void mm_tempo_ramp_free (MMTempoRamp *);
+double mm_tempo_ramp_get_from (const MMTempoRamp *);
+double mm_tempo_ramp_get_to (const MMTempoRamp *);
+unsigned int mm_tempo_ramp_get_length (const MMTempoRamp *);
+double mm_tempo_ramp_get_time (const MMTempoRamp *, double, unsigned int);
+double mm_tempo_ramp_get_bpm (const MMTempoRamp *, double, unsigned int);
+
+#endif /* ! MM_TEMPO_H */
@@ -17,11 +17,13 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <math.h>
 #include <time.h>
 #include <errno.h>
-#include <string.h>
+#include <pthread.h>
 
 #include "timer.h"
+#include "trace.h"
 
 #ifdef CLOCK_MONOTONIC_RAW
 # define MM_CLOCK_ID CLOCK_MONOTONIC_RAW
@@ -29,16 +31,46 @@
 # define MM_CLOCK_ID CLOCK_MONOTONIC
 #endif
 
-#define MM_TIMER_NUM_TAPS 4
+#define MM_TIMER_NUM_TAPS 8
+#define MM_TIMER_MAX_TAP 2000. /* > 30 bpm.  */
+#define MM_TIMER_TAP_TOLERANCE .25
+
+/* In virtual time the clock stands still until the thread that switched
+   it on sleeps, which advances it by exactly the requested time.  Other
+   threads read the same clock but really sleep.  */
+static bool _virtual = false;
+static pthread_t _virtual_owner;
+static uint64_t _virtual_ns = 0;
 
 struct _MMTimer
 {
   struct timespec ts;
-  unsigned int taps[MM_TIMER_NUM_TAPS];
+  /* Tap tempo is a least squares fit of tap time against beat number
+     over the last MM_TIMER_NUM_TAPS taps, kept as running sums.  */
+  double tap_times[MM_TIMER_NUM_TAPS];
+  int tap_beats[MM_TIMER_NUM_TAPS];
   unsigned int curr_tap;
-  unsigned int last_tap_age;
+  unsigned int ntaps;
+  unsigned int rejected;
+  double tap_origin;
+  double reject_time;
+  double sum_k, sum_t, sum_kk, sum_kt;
 };
 
+static bool
+get_time (struct timespec *ts)
+{
+  if (_virtual)
+    {
+      uint64_t ns = __atomic_load_n (&_virtual_ns, __ATOMIC_ACQUIRE);
+      ts->tv_sec = ns / 1000000000;
+      ts->tv_nsec = ns % 1000000000;
+      return true;
+    }
+
+  return clock_gettime (MM_CLOCK_ID, ts) == 0 ? true : false;
+}
+
 MMTimer *
 mm_timer_new ()
 {
@@ -61,7 +93,7 @@ mm_timer_reset (MMTimer *timer)
   if (timer == NULL)
     return false;
   mm_timer_reset_tap (timer);
-  return clock_gettime (MM_CLOCK_ID, &timer->ts) == 0 ? true : false;
+  return get_time (&timer->ts);
 }
 
 unsigned int
@@ -72,31 +104,122 @@ mm_timer_get_age (const MMTimer *timer)
   if (timer == NULL)
     return 0;
 
-  clock_gettime (MM_CLOCK_ID, &now);
+  get_time (&now);
   diff.tv_sec = now.tv_sec - timer->ts.tv_sec;
   diff.tv_nsec = now.tv_nsec - timer->ts.tv_nsec;
 
   return (diff.tv_sec * 1000) + (diff.tv_nsec / 1000000);
 }
 
+/* Milliseconds since reset, without rounding.  */
+static double
+get_age (const MMTimer *timer)
+{
+  struct timespec now;
+
+  get_time (&now);
+  return (now.tv_sec - timer->ts.tv_sec) * 1000.
+    + (now.tv_nsec - timer->ts.tv_nsec) / 1000000.;
+}
+
+static void
+add_tap (MMTimer *timer, int k, double t)
+{
+  unsigned int i;
+
+  if (timer->ntaps == MM_TIMER_NUM_TAPS)
+    {
+      /* Forget the oldest tap.  */
+      i = (timer->curr_tap + 1) % MM_TIMER_NUM_TAPS;
+      timer->sum_k -= timer->tap_beats[i];
+      timer->sum_t -= timer->tap_times[i];
+      timer->sum_kk -= (double) timer->tap_beats[i] * timer->tap_beats[i];
+      timer->sum_kt -= timer->tap_beats[i] * timer->tap_times[i];
+    }
+  else
+    ++timer->ntaps;
+
+  timer->curr_tap = (timer->curr_tap + 1) % MM_TIMER_NUM_TAPS;
+  timer->tap_beats[timer->curr_tap] = k;
+  timer->tap_times[timer->curr_tap] = t;
+  timer->sum_k += k;
+  timer->sum_t += t;
+  timer->sum_kk += (double) k * k;
+  timer->sum_kt += k * t;
+}
+
+/* Fits tap time = PHASE + PERIOD * beat.  */
+static bool
+fit_taps (const MMTimer *timer, double *period, double *phase)
+{
+  double n = timer->ntaps, det;
+
+  if (timer->ntaps < 2)
+    return false;
+
+  det = n * timer->sum_kk - timer->sum_k * timer->sum_k;
+  if (det <= 0.)
+    return false;
+
+  *period = (n * timer->sum_kt - timer->sum_k * timer->sum_t) / det;
+  *phase = (timer->sum_t - *period * timer->sum_k) / n;
+
+  return *period > 0.;
+}
+
+/* Each tap is numbered with the beat it lands closest to, so a missed
+   tap doesn't halve the tempo.  A tap far from any beat is ignored, but
+   two in a row mean the tempo has changed and the fit starts over from
+   them.  */
 void
 mm_timer_tap (MMTimer *timer)
 {
-  unsigned int tap, age;
+  double t, period, phase, beat;
+  int last, k;
 
   if (timer == NULL)
     return;
 
-  age = mm_timer_get_age (timer);
-  tap = age - timer->last_tap_age;
+  t = get_age (timer);
+  if (timer->ntaps > 0
+      && t - timer->tap_origin
+         - timer->tap_times[timer->curr_tap] >= MM_TIMER_MAX_TAP)
+    mm_timer_reset_tap (timer);
+
+  if (timer->ntaps == 0)
+    {
+      timer->tap_origin = t;
+      add_tap (timer, 0, 0.);
+      return;
+    }
 
-  if (timer->last_tap_age > 0 && tap < 2000) /* > 30 bpm */
+  t -= timer->tap_origin;
+  last = timer->tap_beats[timer->curr_tap];
+
+  if (!fit_taps (timer, &period, &phase))
     {
-      timer->curr_tap = (timer->curr_tap + 1) % MM_TIMER_NUM_TAPS;
-      timer->taps[timer->curr_tap] = tap;
+      add_tap (timer, last + 1, t);
+      return;
     }
 
-  timer->last_tap_age = age;
+  beat = (t - phase) / period;
+  k = (int) round (beat);
+  if (k > last && k <= last + 2
+      && fabs (beat - k) <= MM_TIMER_TAP_TOLERANCE)
+    {
+      timer->rejected = 0;
+      add_tap (timer, k, t);
+    }
+  else if (timer->rejected++ > 0
+           && t - timer->reject_time < MM_TIMER_MAX_TAP)
+    {
+      mm_timer_reset_tap (timer);
+      timer->tap_origin += timer->reject_time;
+      add_tap (timer, 0, 0.);
+      add_tap (timer, 1, t - timer->reject_time);
+    }
+  else
+    timer->reject_time = t;
 }
 
 void
@@ -104,45 +227,44 @@ mm_timer_reset_tap (MMTimer *timer)
 {
   if (timer == NULL)
     return;
-  memset (timer->taps, 0, sizeof (unsigned int) * MM_TIMER_NUM_TAPS);
   timer->curr_tap = MM_TIMER_NUM_TAPS - 1;
-  timer->last_tap_age = 0;
-}
-
-static int
-cmp_uint (const void *a, const void *b)
-{
-  unsigned int ia = *(int *) a;
-  unsigned int ib = *(int *) b;
-  return (ia > ib) - (ia < ib);
+  timer->ntaps = 0;
+  timer->rejected = 0;
+  timer->sum_k = timer->sum_t = timer->sum_kk = timer->sum_kt = 0.;
 }
 
 double
 mm_timer_get_bpm (const MMTimer *timer)
 {
-  double median;
-  int ntaps = 0;
-  unsigned int taps[MM_TIMER_NUM_TAPS];
+  double period, phase;
 
-  if (timer == NULL)
+  if (timer == NULL || !fit_taps (timer, &period, &phase))
     return 0.;
 
-  for (int i = 0; i < MM_TIMER_NUM_TAPS; ++i)
-    {
-      if (timer->taps[i] > 0)
-        taps[ntaps++] = timer->taps[i];
-    }
+  return 60000. / period;
+}
 
-  if (ntaps == 0)
-    return 0.;
+/* Gives how long ago, in ms, the fitted beat of the last tap was.  */
+bool
+mm_timer_get_tap_beat (const MMTimer *timer, double *ms_ago)
+{
+  double period, phase;
 
-  qsort (taps, ntaps, sizeof (unsigned int), cmp_uint);
+  if (timer == NULL || ms_ago == NULL || !fit_taps (timer, &period, &phase))
+    return false;
 
-  median = (double) taps[ntaps / 2];
-  if ((ntaps % 2) == 0)
-    median = (median + (double) taps[(ntaps / 2) - 1]) / 2.;
+  *ms_ago = get_age (timer) - timer->tap_origin
+    - (phase + period * timer->tap_beats[timer->curr_tap]);
 
-  return 60000. / median;
+  return true;
+}
+
+uint64_t
+mm_time_us ()
+{
+  struct timespec now;
+  get_time (&now);
+  return ((uint64_t) now.tv_sec * 1000000) + (now.tv_nsec / 1000);
 }
 
 void
@@ -150,6 +272,16 @@ mm_sleep (unsigned int ms)
 {
   int err;
   struct timespec req, rem;
+  MM_TRACE_BEGIN (start);
+
+  if (_virtual && pthread_equal (pthread_self (), _virtual_owner))
+    {
+      __atomic_add_fetch (&_virtual_ns, (uint64_t) ms * 1000000,
+                          __ATOMIC_RELEASE);
+      MM_TRACE_END (MMTP_SLEEP, start, ms);
+      return;
+    }
+
   rem.tv_sec = ms / 1000;
   rem.tv_nsec = (ms % 1000) * 1000000;
   do
@@ -160,4 +292,26 @@ mm_sleep (unsigned int ms)
       err = nanosleep (&req, &rem);
     }
   while (err && (errno == EINTR));
+  MM_TRACE_END (MMTP_SLEEP, start, ms);
+}
+
+/* Switches the calling thread to virtual time, starting from the current
+   real time.  Meant to be called before any timer is created.  */
+void
+mm_time_set_virtual (bool virtual)
+{
+  if (virtual && !_virtual)
+    {
+      struct timespec now;
+      clock_gettime (MM_CLOCK_ID, &now);
+      _virtual_ns = ((uint64_t) now.tv_sec * 1000000000) + now.tv_nsec;
+      _virtual_owner = pthread_self ();
+    }
+  _virtual = virtual;
+}
+
+bool
+mm_time_get_virtual ()
+{
+  return _virtual;
 }
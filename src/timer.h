@@ -19,6 +19,7 @@
 #define MM_TIMER_H 1
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct _MMTimer MMTimer;
 
@@ -29,7 +30,11 @@ unsigned int mm_timer_get_age (const MMTimer *);
 void mm_timer_tap (MMTimer *);
 void mm_timer_reset_tap (MMTimer *);
 double mm_timer_get_bpm (const MMTimer *);
+bool mm_timer_get_tap_beat (const MMTimer *, double *);
 
+uint64_t mm_time_us ();
 void mm_sleep (unsigned int);
+void mm_time_set_virtual (bool);
+bool mm_time_get_virtual ();
 
 #endif /* ! MM_TIMER_H */
@@ -0,0 +1,177 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "print.h"
+
+/* Every thread records into its own ring of TRACE_SIZE entries, the
+   oldest entries are overwritten once it is full.  Rings are only read by
+   mm_trace_write, preferably once the traced threads are done.  */
+#define TRACE_SIZE 65536
+
+#ifdef CLOCK_MONOTONIC_RAW
+# define MM_CLOCK_ID CLOCK_MONOTONIC_RAW
+#else
+# define MM_CLOCK_ID CLOCK_MONOTONIC
+#endif
+
+typedef struct
+{
+  uint64_t start; /* ns.  */
+  uint32_t duration; /* ns.  */
+  uint16_t point;
+  int32_t arg;
+} MMTraceEntry;
+
+typedef struct _MMTraceBuffer MMTraceBuffer;
+
+struct _MMTraceBuffer
+{
+  MMTraceEntry entries[TRACE_SIZE];
+  uint64_t head;
+  unsigned int tid;
+  MMTraceBuffer *next;
+};
+
+bool mm_trace_enabled = false;
+
+static const char *_names[MMTP_NUM_POINTS] = {
+  "input_read",
+  "dispatch",
+  "chord_notes",
+  "output_write",
+  "clock",
+  "sleep"
+};
+
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static MMTraceBuffer *_buffers = NULL;
+static unsigned int _nbuffers = 0;
+static __thread MMTraceBuffer *_buffer = NULL;
+
+static MMTraceBuffer *
+get_buffer ()
+{
+  if (_buffer == NULL)
+    {
+      _buffer = calloc (1, sizeof (MMTraceBuffer));
+      assert (_buffer != NULL);
+
+      pthread_mutex_lock (&_lock);
+      _buffer->tid = ++_nbuffers;
+      _buffer->next = _buffers;
+      _buffers = _buffer;
+      pthread_mutex_unlock (&_lock);
+    }
+
+  return _buffer;
+}
+
+void
+mm_trace_start ()
+{
+  /* The calling thread is listed first.  */
+  get_buffer ();
+  mm_trace_enabled = true;
+}
+
+uint64_t
+mm_trace_now ()
+{
+  struct timespec now;
+  clock_gettime (MM_CLOCK_ID, &now);
+  return ((uint64_t) now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+void
+mm_trace_record (MMTracePoint point, uint64_t start, int arg)
+{
+  MMTraceBuffer *buffer = get_buffer ();
+  uint64_t head = buffer->head;
+  MMTraceEntry *entry = &buffer->entries[head % TRACE_SIZE];
+  uint64_t now = mm_trace_now ();
+
+  entry->start = start;
+  entry->duration = (uint32_t) (now - start);
+  entry->point = point;
+  entry->arg = arg;
+
+  __atomic_store_n (&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Writes all rings in Chrome's trace_event JSON format, loadable in
+   Perfetto or chrome://tracing.  */
+bool
+mm_trace_write (const char *path)
+{
+  FILE *file;
+  bool first = true;
+
+  if (path == NULL)
+    return false;
+
+  file = fopen (path, "w");
+  if (file == NULL)
+    {
+      MMERR ("Failed to open " MMCY ("%s"), path);
+      return false;
+    }
+
+  fprintf (file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+  pthread_mutex_lock (&_lock);
+  for (MMTraceBuffer *buffer = _buffers; buffer != NULL;
+       buffer = buffer->next)
+    {
+      uint64_t head = __atomic_load_n (&buffer->head, __ATOMIC_ACQUIRE);
+      uint64_t tail = head > TRACE_SIZE ? head - TRACE_SIZE : 0;
+
+      fprintf (file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+               "\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+               first ? "" : ",", buffer->tid,
+               buffer->tid == 1 ? "main" : "thread", buffer->tid);
+      first = false;
+
+      for (; tail < head; ++tail)
+        {
+          const MMTraceEntry *entry = &buffer->entries[tail % TRACE_SIZE];
+          fprintf (file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                   "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"args\":{\"arg\":%d}}",
+                   _names[entry->point], buffer->tid,
+                   entry->start / 1000., entry->duration / 1000.,
+                   entry->arg);
+        }
+    }
+  pthread_mutex_unlock (&_lock);
+
+  fprintf (file, "\n]}\n");
+
+  if (fclose (file) != 0)
+    {
+      MMERR ("Failed to write " MMCY ("%s"), path);
+      return false;
+    }
+
+  return true;
+}
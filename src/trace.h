@@ -0,0 +1,58 @@
+/* Copyright (C) 2017 Henrik Hedelund.
+
+   This file is part of MemfisMIDI.
+
+   MemfisMIDI is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   MemfisMIDI is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MemfisMIDI.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef MM_TRACE_H
+#define MM_TRACE_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+  MMTP_INPUT_READ,
+  MMTP_DISPATCH,
+  MMTP_CHORD_NOTES,
+  MMTP_OUTPUT_WRITE,
+  MMTP_CLOCK,
+  MMTP_SLEEP,
+  MMTP_NUM_POINTS
+} MMTracePoint;
+
+/* Tracing is off until mm_trace_start, a disabled trace point costs a
+   single branch.  Use as
+
+     MM_TRACE_BEGIN (t);
+     ...
+     MM_TRACE_END (MMTP_SLEEP, t, ms);  */
+#define MM_TRACE_BEGIN(var) \
+  uint64_t var = mm_trace_enabled ? mm_trace_now () : 0
+#define MM_TRACE_END(point, var, arg)                          \
+  do                                                           \
+    {                                                          \
+      if (mm_trace_enabled)                                    \
+        mm_trace_record ((point), (var), (arg));               \
+    }                                                          \
+  while (0)
+
+extern bool mm_trace_enabled;
+
+void mm_trace_start ();
+uint64_t mm_trace_now ();
+void mm_trace_record (MMTracePoint, uint64_t, int);
+bool mm_trace_write (const char *);
+
+#endif /* ! MM_TRACE_H */